@@ -0,0 +1,260 @@
+// Benchmarks of the painter hot paths, on a headless painter where a GPU is needed
+
+use bufro::{Backends, Color, Font, Painter, Path, PathBuilder, RetentionPolicy, StrokeOptions};
+use criterion::{black_box, criterion_group, criterion_main, BenchmarkId, Criterion};
+use owned_ttf_parser::AsFaceRef;
+use std::time::{Duration, Instant};
+
+const SIZE: (u32, u32) = (800, 600);
+/// Draw calls between flushes, so the command stack stays bounded.
+const CHUNK: u64 = 1000;
+const SHORT_TEXT: &str = "Hello, world!";
+const LONG_TEXT: &str = include_str!("../examples/text.txt");
+const TEXTS: [(&str, &str); 2] = [("short", SHORT_TEXT), ("long", LONG_TEXT)];
+
+fn font() -> Font {
+    Font::new(include_bytes!("../examples/Overpass-Black.ttf")).unwrap()
+}
+
+/// `None` without an adapter, in which case the GPU benchmarks are skipped.
+/// Frames are not read back, so flushes time only the rendering.
+fn painter() -> Option<Painter> {
+    let mut painter = pollster::block_on(Painter::new_headless(SIZE, Backends::all()));
+    match &mut painter {
+        Some(painter) => painter.set_read_back(false),
+        None => eprintln!("no adapter for a headless painter, skipping GPU benchmarks"),
+    }
+    painter
+}
+
+/// A star with `points` points, made of curves like a glyph outline. `seed`
+/// moves one point, so different seeds give different cache entries.
+fn star(points: usize, seed: u32) -> Path {
+    let mut builder = PathBuilder::new();
+    let step = std::f32::consts::PI / points as f32;
+    builder.move_to(100. + seed as f32 * 1e-3, 0.);
+    for i in 1..points * 2 {
+        let radius = if i % 2 == 0 { 100. } else { 40. };
+        let angle = i as f32 * step;
+        let (sin, cos) = angle.sin_cos();
+        let (control_sin, control_cos) = (angle - step / 2.).sin_cos();
+        builder.quad_to(
+            control_cos * 70.,
+            control_sin * 70.,
+            cos * radius,
+            sin * radius,
+        );
+    }
+    builder.close();
+    builder.build()
+}
+
+/// The outlines of every glyph of `text`, side by side in one path.
+fn glyph_path(font: &owned_ttf_parser::OwnedFace, text: &str) -> Path {
+    let face = font.as_face_ref();
+    let mut builder = PathBuilder::new();
+    for c in text.chars() {
+        if let Some(glyph) = face.glyph_index(c) {
+            face.outline_glyph(glyph, &mut builder);
+            let advance = face.glyph_hor_advance(glyph).unwrap_or(0);
+            builder.translate(advance as f32, 0.);
+        }
+    }
+    builder.build()
+}
+
+/// Time `draw` over `iters` calls, flushing every [`CHUNK`] calls outside of
+/// the measurement. `before_chunk` runs untimed before every chunk.
+fn time_draws(
+    painter: &mut Painter,
+    iters: u64,
+    mut before_chunk: impl FnMut(&mut Painter),
+    mut draw: impl FnMut(&mut Painter, u64),
+) -> Duration {
+    let mut total = Duration::default();
+    let mut done = 0;
+    while done < iters {
+        let chunk = CHUNK.min(iters - done);
+        before_chunk(painter);
+        let start = Instant::now();
+        for i in 0..chunk {
+            draw(painter, done + i);
+        }
+        total += start.elapsed();
+        painter.flush().unwrap();
+        done += chunk;
+    }
+    total
+}
+
+fn paths(c: &mut Criterion) {
+    let mut painter = match painter() {
+        Some(painter) => painter,
+        None => return,
+    };
+    let color = Color::from_8(220, 220, 40, 255);
+    let options = StrokeOptions::default().with_line_width(4.);
+    let warm = star(16, 0);
+    // Enough distinct paths for a chunk to miss on every draw.
+    let cold: Vec<Path> = (0..CHUNK as u32).map(|seed| star(16, seed)).collect();
+
+    let mut group = c.benchmark_group("path");
+    group.bench_function("fill warm", |b| {
+        painter.fill_path(&warm, color);
+        painter.flush().unwrap();
+        b.iter_custom(|iters| {
+            time_draws(
+                &mut painter,
+                iters,
+                |_| {},
+                |painter, _| painter.fill_path(black_box(&warm), color),
+            )
+        })
+    });
+    group.bench_function("fill cold", |b| {
+        b.iter_custom(|iters| {
+            time_draws(
+                &mut painter,
+                iters,
+                |painter| painter.clear(),
+                |painter, i| painter.fill_path(&cold[(i % CHUNK) as usize], color),
+            )
+        })
+    });
+    group.bench_function("stroke warm", |b| {
+        painter.stroke_path(&warm, color, options);
+        painter.flush().unwrap();
+        b.iter_custom(|iters| {
+            time_draws(
+                &mut painter,
+                iters,
+                |_| {},
+                |painter, _| painter.stroke_path(black_box(&warm), color, options),
+            )
+        })
+    });
+    group.bench_function("stroke cold", |b| {
+        b.iter_custom(|iters| {
+            time_draws(
+                &mut painter,
+                iters,
+                |painter| painter.clear(),
+                |painter, i| painter.stroke_path(&cold[(i % CHUNK) as usize], color, options),
+            )
+        })
+    });
+    group.finish();
+}
+
+fn text(c: &mut Criterion) {
+    let font = font();
+    let color = Color::from_8(255, 255, 255, 255);
+
+    let mut group = c.benchmark_group("measure_text");
+    for &(name, text) in TEXTS.iter() {
+        group.bench_with_input(BenchmarkId::from_parameter(name), text, |b, text| {
+            b.iter(|| Painter::measure_text(&font, black_box(text), 24., Some(80)))
+        });
+    }
+    group.finish();
+
+    let mut painter = match painter() {
+        Some(painter) => painter,
+        None => return,
+    };
+    let mut group = c.benchmark_group("fill_text");
+    for &(name, text) in TEXTS.iter() {
+        group.bench_with_input(BenchmarkId::from_parameter(name), text, |b, text| {
+            b.iter_custom(|iters| {
+                time_draws(
+                    &mut painter,
+                    iters,
+                    |_| {},
+                    |painter, _| {
+                        painter.fill_text(&font, black_box(text), 10., 30., 24., color, Some(80))
+                    },
+                )
+            })
+        });
+    }
+    group.finish();
+}
+
+fn path_builder(c: &mut Criterion) {
+    let face = owned_ttf_parser::OwnedFace::from_vec(
+        include_bytes!("../examples/Overpass-Black.ttf").to_vec(),
+        0,
+    )
+    .unwrap();
+
+    let mut group = c.benchmark_group("path_builder");
+    group.bench_function("glyphs", |b| {
+        b.iter(|| glyph_path(&face, black_box(SHORT_TEXT)))
+    });
+    group.bench_function("star", |b| b.iter(|| star(black_box(64), 0)));
+    group.finish();
+}
+
+fn geometry_churn(c: &mut Criterion) {
+    let mut painter = match painter() {
+        Some(painter) => painter,
+        None => return,
+    };
+    // Every frame draws paths the previous frames did not, and evicts the
+    // ones that went undrawn.
+    painter.set_retention_policy(RetentionPolicy {
+        max_age: 1,
+        max_bytes: Some(4 * 1024 * 1024),
+        max_pooled_bytes: Some(1024 * 1024),
+        ..RetentionPolicy::default()
+    });
+    let paths: Vec<Path> = (0..2000).map(|seed| star(8, seed)).collect();
+    let color = Color::from_8(30, 90, 200, 255);
+    let per_frame = 200;
+
+    let mut frame = 0;
+    c.bench_function("geometry churn", |b| {
+        b.iter(|| {
+            let start = frame * per_frame % paths.len();
+            for path in paths[start..start + per_frame].iter() {
+                painter.fill_path(path, color);
+            }
+            painter.flush().unwrap();
+            frame += 1;
+        })
+    });
+}
+
+fn flush(c: &mut Criterion) {
+    let mut painter = match painter() {
+        Some(painter) => painter,
+        None => return,
+    };
+
+    let mut group = c.benchmark_group("flush");
+    for &shapes in [100, 1000, 10000].iter() {
+        group.bench_with_input(
+            BenchmarkId::from_parameter(shapes),
+            &shapes,
+            |b, &shapes| {
+                b.iter(|| {
+                    for i in 0..shapes {
+                        let x = (i * 37 % SIZE.0 as usize) as f32;
+                        let y = (i * 91 % SIZE.1 as usize) as f32;
+                        let color = Color::from_8(i as u8, 90, 200, 255);
+                        if i % 2 == 0 {
+                            painter.rectangle(x, y, 20., 10., color);
+                        } else {
+                            painter.circle(x, y, 8., color);
+                        }
+                    }
+                    painter.flush().unwrap();
+                })
+            },
+        );
+    }
+    group.finish();
+}
+
+criterion_group!(benches, paths, text, path_builder, geometry_churn, flush);
+criterion_main!(benches);
@@ -167,6 +167,8 @@ fn main() {
         (500, 500),
         bufro::Backends::all(),
     ));
+    // Tanks are mostly circles, which need no tessellation when analytic.
+    painter.set_shape_mode(bufro::ShapeMode::Analytic);
     let font = bufro::Font::new(include_bytes!("Overpass-Black.ttf")).unwrap();
 
     // tesselate a grid
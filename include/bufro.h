@@ -9,6 +9,29 @@
 #include <stdlib.h>
 
 
+typedef enum BufroCmd_Tag {
+    BufroCmdSave,
+    BufroCmdRestore,
+    BufroCmdReset,
+    BufroCmdTranslate,
+    BufroCmdScale,
+    BufroCmdRotate,
+    BufroCmdRectangle,
+    BufroCmdCircle,
+    BufroCmdFillPath,
+    BufroCmdStrokePath,
+    /**
+     * `len` bytes of UTF-8 `text`, not null terminated. The command is skipped
+     * if `text` isn't valid UTF-8
+     */
+    BufroCmdFillText,
+    /**
+     * `len` bytes of UTF-8 `text`, not null terminated. The command is skipped
+     * if `text` isn't valid UTF-8
+     */
+    BufroCmdStrokeText,
+} BufroCmd_Tag;
+
 typedef enum BufroFlushResult {
     BufroFlushResultTimeout,
     BufroFlushResultOutdated,
@@ -69,8 +92,32 @@ typedef enum BufroLineJoin {
     BufroLineJoinBevel,
 } BufroLineJoin;
 
+typedef enum BufroPresentMode {
+    BufroPresentModeImmediate,
+    BufroPresentModeMailbox,
+    BufroPresentModeFifo,
+} BufroPresentMode;
+
 typedef struct BufroFont BufroFont;
 
+/**
+ * A [`Layer`] rendered into a texture by [`Painter::render_layer`], drawn as a
+ * single quad by [`Painter::draw_cached_layer`]. Render the layer again to
+ * invalidate it.
+ */
+typedef struct CachedLayer CachedLayer;
+
+/**
+ * Drawing commands recorded once with [`Painter::begin_layer`] and
+ * [`Painter::end_layer`], and replayed with [`Painter::draw_layer`].
+ *
+ * Replaying skips tessellation, path hashing and glyph layout. The layer keeps
+ * what is needed to tessellate its geometry again, so it stays valid after the
+ * geometry cache evicts it or [`Painter::clear`] is called. Its atlas text is
+ * skipped once the glyph atlas is cleared or evicts a page.
+ */
+typedef struct Layer Layer;
+
 /**
  * Object that manages the window and GPU resources
  */
@@ -80,6 +127,20 @@ typedef struct Path Path;
 
 typedef struct PathBuilder PathBuilder;
 
+/**
+ * Records drawing commands on another thread, to be merged into the frame of
+ * a painter with [`Painter::draw_recorder`]. Made by [`Painter::recorder`].
+ *
+ * A recorder has its own transform stack and command list, starting from the
+ * painter's transform when it was made, so that it picks the level of detail
+ * the geometry is drawn at. It sees the geometry cache as it was when it was
+ * made, so that only geometry missing from it is prepared for tessellation.
+ * Merge recorders in the frame they were made in, as a flush may evict that
+ * geometry. Text is always tessellated, as the glyph atlas belongs to the
+ * painter.
+ */
+typedef struct Recorder Recorder;
+
 typedef struct BufroColor {
     float r;
     float g;
@@ -126,10 +187,183 @@ typedef struct BufroStrokeOptions {
     float miter_limit;
 } BufroStrokeOptions;
 
+/**
+ * Counters of a painter, for scraping into metrics every frame.
+ *
+ * Cache lookups and uploaded bytes add up over the lifetime of the painter,
+ * the per frame counters describe the last flushed frame, and the remaining
+ * ones the current GPU memory use.
+ */
+typedef struct PainterStats {
+    /**
+     * Rectangles that found their unit geometry cached.
+     */
+    uint64_t rectangle_hits;
+    uint64_t rectangle_misses;
+    /**
+     * Circles that found their unit geometry of the right LOD cached.
+     */
+    uint64_t circle_hits;
+    uint64_t circle_misses;
+    /**
+     * Filled and stroked paths.
+     */
+    uint64_t path_hits;
+    uint64_t path_misses;
+    /**
+     * Filled and stroked glyph outlines.
+     */
+    uint64_t glyph_hits;
+    uint64_t glyph_misses;
+    /**
+     * Glyphs found in the glyph atlas, or rasterized into it.
+     */
+    uint64_t atlas_glyph_hits;
+    uint64_t atlas_glyph_misses;
+    /**
+     * Cached geometries evicted by the retention policy.
+     */
+    uint64_t evictions;
+    /**
+     * Bytes written to GPU buffers and textures.
+     */
+    uint64_t uploaded_bytes;
+    /**
+     * Vertices tessellated during the last frame.
+     */
+    uint64_t tessellated_vertices;
+    /**
+     * Indices tessellated during the last frame.
+     */
+    uint64_t tessellated_indices;
+    /**
+     * Draw calls of the last frame, including rendered layers.
+     */
+    uint64_t draw_calls;
+    /**
+     * Instances drawn by the last frame, including rendered layers.
+     */
+    uint64_t instances;
+    /**
+     * Number of geometries currently cached.
+     */
+    uint64_t resident_geometries;
+    /**
+     * Bytes of arena space holding cached geometry.
+     */
+    uint64_t geometry_resident_bytes;
+    /**
+     * Bytes of arena space free for new geometry.
+     */
+    uint64_t geometry_pooled_bytes;
+    /**
+     * Bytes of the instance buffers.
+     */
+    uint64_t instance_buffer_bytes;
+    /**
+     * Bytes of the uniform buffer.
+     */
+    uint64_t uniform_buffer_bytes;
+    /**
+     * Texture pages of the glyph atlas.
+     */
+    uint64_t atlas_pages;
+    /**
+     * Glyph atlas pages evicted by the retention policy.
+     */
+    uint64_t atlas_evictions;
+} PainterStats;
+
+typedef struct BufroCmdTranslate_Body {
+    float x;
+    float y;
+} BufroCmdTranslate_Body;
+
+typedef struct BufroCmdScale_Body {
+    float x;
+    float y;
+} BufroCmdScale_Body;
+
+typedef struct BufroCmdRotate_Body {
+    float angle;
+} BufroCmdRotate_Body;
+
+typedef struct BufroCmdRectangle_Body {
+    float x;
+    float y;
+    float width;
+    float height;
+    struct BufroColor color;
+} BufroCmdRectangle_Body;
+
+typedef struct BufroCmdCircle_Body {
+    float x;
+    float y;
+    float radius;
+    struct BufroColor color;
+} BufroCmdCircle_Body;
+
+typedef struct BufroCmdFillPath_Body {
+    const struct Path *path;
+    struct BufroColor color;
+} BufroCmdFillPath_Body;
+
+typedef struct BufroCmdStrokePath_Body {
+    const struct Path *path;
+    struct BufroColor color;
+    struct BufroStrokeOptions options;
+} BufroCmdStrokePath_Body;
+
+typedef struct BufroCmdFillText_Body {
+    const struct BufroFont *font;
+    const char *text;
+    size_t len;
+    float x;
+    float y;
+    float size;
+    struct BufroColor color;
+    size_t wrap_limit;
+} BufroCmdFillText_Body;
+
+typedef struct BufroCmdStrokeText_Body {
+    const struct BufroFont *font;
+    const char *text;
+    size_t len;
+    float x;
+    float y;
+    float size;
+    struct BufroColor color;
+    struct BufroStrokeOptions options;
+    size_t wrap_limit;
+} BufroCmdStrokeText_Body;
+
+/**
+ * one command of a command stream submitted with bfr_painter_submit
+ */
+typedef struct BufroCmd {
+    BufroCmd_Tag tag;
+    union {
+        BufroCmdTranslate_Body bufro_cmd_translate;
+        BufroCmdScale_Body bufro_cmd_scale;
+        BufroCmdRotate_Body bufro_cmd_rotate;
+        BufroCmdRectangle_Body bufro_cmd_rectangle;
+        BufroCmdCircle_Body bufro_cmd_circle;
+        BufroCmdFillPath_Body bufro_cmd_fill_path;
+        BufroCmdStrokePath_Body bufro_cmd_stroke_path;
+        BufroCmdFillText_Body bufro_cmd_fill_text;
+        BufroCmdStrokeText_Body bufro_cmd_stroke_text;
+    };
+} BufroCmd;
+
 #ifdef __cplusplus
 extern "C" {
 #endif // __cplusplus
 
+/**
+ * free cached layer
+ */
+void bfr_cached_layer_free(struct CachedLayer *layer);
+
 /**
  * bufro color from floats
  */
@@ -147,6 +381,16 @@ void bfr_font_free(struct BufroFont *font);
 
 uint8_t bfr_font_from_buffer(const char *data, size_t len, struct BufroFont **ptr);
 
+/**
+ * free layer
+ */
+void bfr_layer_free(struct Layer *layer);
+
+/**
+ * begin recording a layer on painter
+ */
+void bfr_painter_begin_layer(struct Painter *painter);
+
 /**
  * circle on painter
  */
@@ -161,6 +405,39 @@ void bfr_painter_circle(struct Painter *painter,
  */
 void bfr_painter_clear(struct Painter *painter);
 
+/**
+ * create every pipeline of painter now instead of on first use
+ */
+void bfr_painter_create_pipelines(struct Painter *painter);
+
+/**
+ * draw cached layer on painter
+ */
+void bfr_painter_draw_cached_layer(struct Painter *painter,
+                                   const struct CachedLayer *layer,
+                                   float x,
+                                   float y);
+
+/**
+ * draw layer on painter
+ */
+void bfr_painter_draw_layer(struct Painter *painter, const struct Layer *layer);
+
+/**
+ * draw recorder on painter and free it
+ */
+void bfr_painter_draw_recorder(struct Painter *painter, struct Recorder *recorder);
+
+/**
+ * draw and submit the frame of painter, to show with bfr_painter_present
+ */
+void bfr_painter_end_frame(struct Painter *painter);
+
+/**
+ * end recording a layer on painter
+ */
+struct Layer *bfr_painter_end_layer(struct Painter *painter);
+
 /**
  * fill path on painter
  */
@@ -199,6 +476,31 @@ struct Painter *bfr_painter_from_xlib_window(struct BufroXlibWindow handle,
  */
 const char *bfr_painter_get_buffer_info_string(struct Painter *painter);
 
+/**
+ * get the cache, per frame and memory counters of painter
+ */
+struct PainterStats bfr_painter_get_stats(const struct Painter *painter);
+
+/**
+ * create a painter drawing into an offscreen texture, null if there is no adapter
+ */
+struct Painter *bfr_painter_new_headless(uint32_t width, uint32_t height, uint32_t backend);
+
+/**
+ * show the frame submitted by bfr_painter_end_frame on painter
+ */
+enum BufroFlushResult bfr_painter_present(struct Painter *painter);
+
+/**
+ * read the oldest unread frame of a headless painter into `len` bytes of RGBA pixels
+ */
+bool bfr_painter_read_pixels(struct Painter *painter, uint8_t *pixels, size_t len, bool wait);
+
+/**
+ * make a recorder for painter, which can be filled on another thread
+ */
+struct Recorder *bfr_painter_recorder(struct Painter *painter);
+
 void bfr_painter_rectangle(struct Painter *painter,
                            float x,
                            float y,
@@ -211,6 +513,14 @@ void bfr_painter_rectangle(struct Painter *painter,
  */
 void bfr_painter_regen(struct Painter *painter);
 
+/**
+ * render layer into a texture on painter
+ */
+struct CachedLayer *bfr_painter_render_layer(struct Painter *painter,
+                                             const struct Layer *layer,
+                                             uint32_t width,
+                                             uint32_t height);
+
 void bfr_painter_resize(struct Painter *painter, uint32_t width, uint32_t height);
 
 /**
@@ -223,6 +533,17 @@ void bfr_painter_restore(struct Painter *painter);
  */
 void bfr_painter_rotate(struct Painter *painter, float angle);
 
+/**
+ * rounded rectangle on painter
+ */
+void bfr_painter_rounded_rectangle(struct Painter *painter,
+                                   float x,
+                                   float y,
+                                   float width,
+                                   float height,
+                                   float radius,
+                                   struct BufroColor color);
+
 /**
  * save painter
  */
@@ -233,6 +554,43 @@ void bfr_painter_save(struct Painter *painter);
  */
 void bfr_painter_scale(struct Painter *painter, float x, float y);
 
+/**
+ * draw circles on painter with the analytic shape pipeline, or tessellate them
+ */
+void bfr_painter_set_analytic_circles(struct Painter *painter, bool enabled);
+
+/**
+ * fill paths on painter with the compute rasterizer, or tessellate them
+ */
+void bfr_painter_set_compute_fills(struct Painter *painter, bool enabled);
+
+/**
+ * set sample count and present mode on painter
+ */
+void bfr_painter_set_config(struct Painter *painter,
+                            uint32_t sample_count,
+                            enum BufroPresentMode present_mode);
+
+/**
+ * redraw only what changed since the last frame on painter
+ */
+void bfr_painter_set_damage_tracking(struct Painter *painter, bool enabled);
+
+/**
+ * profile the frames of painter
+ */
+void bfr_painter_set_profiling(struct Painter *painter, bool enabled);
+
+/**
+ * stroke circle on painter
+ */
+void bfr_painter_stroke_circle(struct Painter *painter,
+                               float x,
+                               float y,
+                               float radius,
+                               struct BufroColor color,
+                               float line_width);
+
 /**
  * stroke path on painter
  */
@@ -241,6 +599,18 @@ void bfr_painter_stroke_path(struct Painter *painter,
                              struct BufroColor color,
                              struct BufroStrokeOptions options);
 
+/**
+ * stroke rounded rectangle on painter
+ */
+void bfr_painter_stroke_rounded_rectangle(struct Painter *painter,
+                                          float x,
+                                          float y,
+                                          float width,
+                                          float height,
+                                          float radius,
+                                          struct BufroColor color,
+                                          float line_width);
+
 /**
  * stroke text on painter
  */
@@ -254,11 +624,26 @@ void bfr_painter_stroke_text(struct Painter *painter,
                              struct BufroStrokeOptions options,
                              size_t wrap_limit);
 
+/**
+ * run `len` commands on painter in one call, as if each was its own bfr_painter_* call
+ */
+void bfr_painter_submit(struct Painter *painter, const struct BufroCmd *commands, size_t len);
+
 /**
  * translate painter
  */
 void bfr_painter_translate(struct Painter *painter, float x, float y);
 
+/**
+ * write the profiled frames of painter as chrome trace json to path
+ */
+uint8_t bfr_painter_write_chrome_trace(const struct Painter *painter, const char *path);
+
+/**
+ * get the content hash of a path
+ */
+uint64_t bfr_path_get_id(const struct Path *path);
+
 /**
  * TODO: This is a hack.
  */
@@ -328,6 +713,16 @@ void bfr_pathbuilder_scale(struct PathBuilder *pathbuilder, float x, float y);
  */
 void bfr_pathbuilder_translate(struct PathBuilder *pathbuilder, float x, float y);
 
+/**
+ * free recorder without drawing it
+ */
+void bfr_recorder_free(struct Recorder *recorder);
+
+/**
+ * run `len` commands on recorder, like bfr_painter_submit
+ */
+void bfr_recorder_submit(struct Recorder *recorder, const struct BufroCmd *commands, size_t len);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif // __cplusplus
@@ -0,0 +1,684 @@
+// Glyph atlas: glyphs rasterized on the CPU into texture pages and drawn as textured quads
+
+use crate::{Font, Instance, PainterStats, PREMULTIPLIED_BLEND};
+use owned_ttf_parser::AsFaceRef;
+use std::collections::HashMap;
+
+/// Width and height of an atlas page, in texels.
+const PAGE_SIZE: u32 = 1024;
+
+/// Bytes of an atlas page.
+pub(crate) const PAGE_BYTES: usize = (PAGE_SIZE * PAGE_SIZE) as usize;
+
+/// Em sizes up to this are rasterized at whole pixels; larger ones share
+/// quarter-octave steps, so zooming text does not rasterize every size.
+const EXACT_SIZES: f32 = 16.;
+
+/// The pixel size to rasterize glyphs of an on-screen em size of `size` at.
+/// Rounds up, as shrinking a bitmap blurs less than growing it.
+pub(crate) fn bucket_size(size: f32) -> u16 {
+    if size <= EXACT_SIZES {
+        return size.round().max(1.) as u16;
+    }
+    let steps = (size.log2() * 4.).ceil();
+    (steps / 4.).exp2().round().min(u16::MAX as f32) as u16
+}
+
+/// Empty texels kept around every glyph so bilinear filtering never bleeds
+/// into a neighbour.
+const PADDING: i32 = 1;
+
+/// Per-instance data of a glyph quad: the placement and color of the geometry
+/// pipeline followed by the glyph's rectangle in the atlas page.
+#[repr(C)]
+#[derive(Copy, Clone, Debug, bytemuck::Pod, bytemuck::Zeroable)]
+pub(crate) struct GlyphInstance {
+    pub(crate) transform: [[f32; 2]; 3],
+    color: [u16; 4],
+    uv: [f32; 4],
+}
+
+impl GlyphInstance {
+    pub(crate) fn new(instance: Instance, glyph: &AtlasGlyph) -> Self {
+        Self {
+            transform: instance.transform,
+            color: instance.color,
+            uv: glyph.uv,
+        }
+    }
+
+    const ATTRIBUTES: [wgpu::VertexAttribute; 5] = wgpu::vertex_attr_array![
+        2 => Float32x2,
+        3 => Float32x2,
+        4 => Float32x2,
+        5 => Unorm16x4,
+        6 => Float32x4,
+    ];
+
+    fn desc<'a>() -> wgpu::VertexBufferLayout<'a> {
+        wgpu::VertexBufferLayout {
+            array_stride: std::mem::size_of::<GlyphInstance>() as wgpu::BufferAddress,
+            step_mode: wgpu::VertexStepMode::Instance,
+            attributes: &Self::ATTRIBUTES,
+        }
+    }
+}
+
+/// Accumulation buffer rasterizer in the style of font-rs: every line adds its
+/// signed area coverage to the cells it crosses, and a running sum over each
+/// row yields the coverage of every pixel.
+struct Rasterizer {
+    width: usize,
+    height: usize,
+    accumulation: Vec<f32>,
+    /// Maps font units to pixels: `(scale, -scale)` followed by the offset.
+    scale: f32,
+    offset: (f32, f32),
+    start: (f32, f32),
+    last: (f32, f32),
+}
+
+impl Rasterizer {
+    fn new(width: usize, height: usize, scale: f32, offset: (f32, f32)) -> Self {
+        Self {
+            width,
+            height,
+            // A few spare cells absorb the writes just past the last pixel.
+            accumulation: vec![0.; width * height + 4],
+            scale,
+            offset,
+            start: (0., 0.),
+            last: (0., 0.),
+        }
+    }
+
+    fn to_pixels(&self, x: f32, y: f32) -> (f32, f32) {
+        // Clamp horizontally so that outlines poking out of their bounding box
+        // cannot write outside of their row; rows are clipped in `draw_line`.
+        (
+            (x * self.scale - self.offset.0)
+                .max(0.)
+                .min(self.width as f32 - 1.),
+            -y * self.scale - self.offset.1,
+        )
+    }
+
+    fn draw_line(&mut self, p0: (f32, f32), p1: (f32, f32)) {
+        if (p0.1 - p1.1).abs() <= f32::EPSILON {
+            return;
+        }
+        let (direction, p0, p1) = if p0.1 < p1.1 {
+            (1., p0, p1)
+        } else {
+            (-1., p1, p0)
+        };
+        let dxdy = (p1.0 - p0.0) / (p1.1 - p0.1);
+        let mut x = p0.0;
+        if p0.1 < 0. {
+            x -= p0.1 * dxdy;
+        }
+        let last_row = self.height.min(p1.1.ceil() as usize);
+        for y in (p0.1.max(0.) as usize)..last_row {
+            let row = y * self.width;
+            let dy = ((y + 1) as f32).min(p1.1) - (y as f32).max(p0.1);
+            let x_next = x + dxdy * dy;
+            let d = dy * direction;
+            let (x0, x1) = if x < x_next { (x, x_next) } else { (x_next, x) };
+            let x0_floor = x0.floor();
+            let x0i = x0_floor as usize;
+            let x1_ceil = x1.ceil();
+            let x1i = x1_ceil as usize;
+            if x1i <= x0i + 1 {
+                let xmf = 0.5 * (x + x_next) - x0_floor;
+                self.accumulation[row + x0i] += d - d * xmf;
+                self.accumulation[row + x0i + 1] += d * xmf;
+            } else {
+                let s = (x1 - x0).recip();
+                let x0f = x0 - x0_floor;
+                let a0 = 0.5 * s * (1. - x0f) * (1. - x0f);
+                let x1f = x1 - x1_ceil + 1.;
+                let am = 0.5 * s * x1f * x1f;
+                self.accumulation[row + x0i] += d * a0;
+                if x1i == x0i + 2 {
+                    self.accumulation[row + x0i + 1] += d * (1. - a0 - am);
+                } else {
+                    let a1 = s * (1.5 - x0f);
+                    self.accumulation[row + x0i + 1] += d * (a1 - a0);
+                    for xi in x0i + 2..x1i - 1 {
+                        self.accumulation[row + xi] += d * s;
+                    }
+                    let a2 = a1 + (x1i - x0i - 3) as f32 * s;
+                    self.accumulation[row + x1i - 1] += d * (1. - a2 - am);
+                }
+                self.accumulation[row + x1i] += d * am;
+            }
+            x = x_next;
+        }
+    }
+
+    /// Flatten a curve into `segments` lines, evaluating it with `point`.
+    fn draw_curve(&mut self, segments: usize, point: impl Fn(f32) -> (f32, f32)) {
+        let mut previous = self.last;
+        for i in 1..=segments {
+            let next = point(i as f32 / segments as f32);
+            self.draw_line(previous, next);
+            previous = next;
+        }
+        self.last = previous;
+    }
+
+    /// Number of lines to flatten a curve with the given control polygon length into.
+    fn segments(length: f32) -> usize {
+        (length.sqrt().ceil() as usize).max(1).min(64)
+    }
+
+    /// Sum the accumulated coverage into 8 bit alpha.
+    fn coverage(&self) -> Vec<u8> {
+        let mut sum = 0.;
+        self.accumulation[..self.width * self.height]
+            .iter()
+            .map(|cell| {
+                sum += cell;
+                (sum.abs().min(1.) * 255.) as u8
+            })
+            .collect()
+    }
+}
+
+fn distance(a: (f32, f32), b: (f32, f32)) -> f32 {
+    ((a.0 - b.0).powi(2) + (a.1 - b.1).powi(2)).sqrt()
+}
+
+impl owned_ttf_parser::OutlineBuilder for Rasterizer {
+    fn move_to(&mut self, x: f32, y: f32) {
+        let point = self.to_pixels(x, y);
+        self.start = point;
+        self.last = point;
+    }
+
+    fn line_to(&mut self, x: f32, y: f32) {
+        let point = self.to_pixels(x, y);
+        self.draw_line(self.last, point);
+        self.last = point;
+    }
+
+    fn quad_to(&mut self, x1: f32, y1: f32, x: f32, y: f32) {
+        let (p0, p1, p2) = (self.last, self.to_pixels(x1, y1), self.to_pixels(x, y));
+        let segments = Self::segments(distance(p0, p1) + distance(p1, p2));
+        self.draw_curve(segments, |t| {
+            let mt = 1. - t;
+            (
+                mt * mt * p0.0 + 2. * mt * t * p1.0 + t * t * p2.0,
+                mt * mt * p0.1 + 2. * mt * t * p1.1 + t * t * p2.1,
+            )
+        });
+    }
+
+    fn curve_to(&mut self, x1: f32, y1: f32, x2: f32, y2: f32, x: f32, y: f32) {
+        let (p0, p1, p2, p3) = (
+            self.last,
+            self.to_pixels(x1, y1),
+            self.to_pixels(x2, y2),
+            self.to_pixels(x, y),
+        );
+        let segments = Self::segments(distance(p0, p1) + distance(p1, p2) + distance(p2, p3));
+        self.draw_curve(segments, |t| {
+            let mt = 1. - t;
+            let (a, b, c, d) = (mt * mt * mt, 3. * mt * mt * t, 3. * mt * t * t, t * t * t);
+            (
+                a * p0.0 + b * p1.0 + c * p2.0 + d * p3.0,
+                a * p0.1 + b * p1.1 + c * p2.1 + d * p3.1,
+            )
+        });
+    }
+
+    fn close(&mut self) {
+        self.draw_line(self.last, self.start);
+        self.last = self.start;
+    }
+}
+
+/// Packs rectangles into rows of fixed height, the simplest packer that works
+/// well for glyphs of a similar size.
+struct ShelfPacker {
+    /// `(y, height, used width)` of every shelf.
+    shelves: Vec<(u32, u32, u32)>,
+    bottom: u32,
+}
+
+impl ShelfPacker {
+    fn new() -> Self {
+        Self {
+            shelves: Vec::new(),
+            bottom: 0,
+        }
+    }
+
+    fn allocate(&mut self, width: u32, height: u32) -> Option<(u32, u32)> {
+        if width > PAGE_SIZE || height > PAGE_SIZE {
+            return None;
+        }
+
+        // Use the lowest existing shelf that fits, without wasting more than a
+        // quarter of its height.
+        let shelf = self
+            .shelves
+            .iter_mut()
+            .filter(|(_, shelf_height, used)| {
+                *shelf_height >= height
+                    && *shelf_height <= height + height / 4 + 1
+                    && *used + width <= PAGE_SIZE
+            })
+            .min_by_key(|(_, shelf_height, _)| *shelf_height);
+        if let Some((y, _, used)) = shelf {
+            let x = *used;
+            *used += width;
+            return Some((x, *y));
+        }
+
+        if self.bottom + height > PAGE_SIZE {
+            return None;
+        }
+        let y = self.bottom;
+        self.shelves.push((y, height, width));
+        self.bottom += height;
+        Some((0, y))
+    }
+}
+
+struct AtlasPage {
+    texture: wgpu::Texture,
+    bind_group: wgpu::BindGroup,
+    packer: ShelfPacker,
+    /// The frame a glyph of this page was last looked up in.
+    last_used: u64,
+}
+
+/// A glyph rasterized into the atlas.
+#[derive(Clone, Copy, Debug)]
+pub(crate) struct AtlasGlyph {
+    pub(crate) page: usize,
+    /// Top left and bottom right corner in normalized texture coordinates.
+    uv: [f32; 4],
+    /// Top left corner of the bitmap relative to the pen position, in texels.
+    pub(crate) origin: [f32; 2],
+    /// Size of the bitmap, in texels.
+    pub(crate) size: [f32; 2],
+}
+
+/// Glyph bitmaps rasterized at integer pixel sizes, packed into texture pages.
+pub(crate) struct GlyphAtlas {
+    /// Created on first use, as painters without atlas text never need it.
+    pipeline: Option<wgpu::RenderPipeline>,
+    bind_group_layout: wgpu::BindGroupLayout,
+    sampler: wgpu::Sampler,
+    /// `None` for pages that were evicted, whose index is reused by the next page.
+    pages: Vec<Option<AtlasPage>>,
+    /// Keyed by font id, glyph id and pixel size; `None` for glyphs without an outline.
+    glyphs: HashMap<(u64, u16, u16), Option<AtlasGlyph>>,
+    /// Bumped by every `clear` and eviction, which invalidate the placement of
+    /// glyphs.
+    generation: u64,
+    /// Counts the frames ended, to find the least recently used pages.
+    frame: u64,
+    hits: u64,
+    misses: u64,
+    evictions: u64,
+    uploaded_bytes: u64,
+}
+
+impl GlyphAtlas {
+    pub(crate) fn new(device: &wgpu::Device) -> Self {
+        let bind_group_layout = device.create_bind_group_layout(&wgpu::BindGroupLayoutDescriptor {
+            entries: &[
+                wgpu::BindGroupLayoutEntry {
+                    binding: 0,
+                    visibility: wgpu::ShaderStages::FRAGMENT,
+                    ty: wgpu::BindingType::Texture {
+                        sample_type: wgpu::TextureSampleType::Float { filterable: true },
+                        view_dimension: wgpu::TextureViewDimension::D2,
+                        multisampled: false,
+                    },
+                    count: None,
+                },
+                wgpu::BindGroupLayoutEntry {
+                    binding: 1,
+                    visibility: wgpu::ShaderStages::FRAGMENT,
+                    ty: wgpu::BindingType::Sampler {
+                        filtering: true,
+                        comparison: false,
+                    },
+                    count: None,
+                },
+            ],
+            label: Some("Glyph Atlas Bind Group Layout"),
+        });
+
+        let sampler = device.create_sampler(&wgpu::SamplerDescriptor {
+            label: Some("Glyph Atlas Sampler"),
+            address_mode_u: wgpu::AddressMode::ClampToEdge,
+            address_mode_v: wgpu::AddressMode::ClampToEdge,
+            address_mode_w: wgpu::AddressMode::ClampToEdge,
+            mag_filter: wgpu::FilterMode::Linear,
+            min_filter: wgpu::FilterMode::Linear,
+            mipmap_filter: wgpu::FilterMode::Nearest,
+            ..Default::default()
+        });
+
+        Self {
+            pipeline: None,
+            bind_group_layout,
+            sampler,
+            pages: Vec::new(),
+            glyphs: HashMap::new(),
+            generation: 0,
+            frame: 0,
+            hits: 0,
+            misses: 0,
+            evictions: 0,
+            uploaded_bytes: 0,
+        }
+    }
+
+    /// The pipeline created by [`GlyphAtlas::create_pipeline`].
+    pub(crate) fn pipeline(&self) -> &wgpu::RenderPipeline {
+        self.pipeline
+            .as_ref()
+            .expect("glyph atlas pipeline used before it was created")
+    }
+
+    /// Create the pipeline if it does not exist yet.
+    pub(crate) fn create_pipeline(
+        &mut self,
+        device: &wgpu::Device,
+        uniform_bind_group_layout: &wgpu::BindGroupLayout,
+        format: wgpu::TextureFormat,
+        sample_count: u32,
+    ) {
+        if self.pipeline.is_none() {
+            self.pipeline = Some(create_pipeline(
+                device,
+                uniform_bind_group_layout,
+                &self.bind_group_layout,
+                format,
+                sample_count,
+            ));
+        }
+    }
+
+    /// Drop the pipeline, to be created again for a different sample count.
+    /// Every glyph is kept.
+    pub(crate) fn reset_pipeline(&mut self) {
+        self.pipeline = None;
+    }
+
+    pub(crate) fn generation(&self) -> u64 {
+        self.generation
+    }
+
+    /// Fill in the atlas counters of `stats`.
+    pub(crate) fn stats(&self, stats: &mut PainterStats) {
+        stats.atlas_glyph_hits = self.hits;
+        stats.atlas_glyph_misses = self.misses;
+        stats.atlas_pages = self.pages.iter().flatten().count() as u64;
+        stats.atlas_evictions = self.evictions;
+        stats.uploaded_bytes += self.uploaded_bytes;
+    }
+
+    pub(crate) fn bind_group(&self, page: usize) -> &wgpu::BindGroup {
+        &self.pages[page]
+            .as_ref()
+            .expect("glyph drawn from an evicted atlas page")
+            .bind_group
+    }
+
+    /// Look up a glyph rasterized at `size` pixels per em, rasterizing and
+    /// uploading it on first use. Returns `None` for glyphs without an outline.
+    pub(crate) fn glyph(
+        &mut self,
+        device: &wgpu::Device,
+        queue: &wgpu::Queue,
+        font: &Font,
+        glyph: owned_ttf_parser::GlyphId,
+        size: u16,
+    ) -> Option<AtlasGlyph> {
+        let key = (font.id, glyph.0, size);
+        let entry = match self.glyphs.get(&key) {
+            Some(entry) => {
+                self.hits += 1;
+                *entry
+            }
+            None => {
+                self.misses += 1;
+                let entry = self.rasterize(device, queue, font, glyph, size);
+                self.glyphs.insert(key, entry);
+                entry
+            }
+        };
+        if let Some(entry) = &entry {
+            self.pages[entry.page].as_mut().unwrap().last_used = self.frame;
+        }
+        entry
+    }
+
+    fn rasterize(
+        &mut self,
+        device: &wgpu::Device,
+        queue: &wgpu::Queue,
+        font: &Font,
+        glyph: owned_ttf_parser::GlyphId,
+        size: u16,
+    ) -> Option<AtlasGlyph> {
+        let face = font.font.as_face_ref();
+        let bbox = face.glyph_bounding_box(glyph)?;
+        let scale = size as f32 / face.units_per_em()? as f32;
+
+        // Pixel bounds of the glyph with the y axis pointing down.
+        let left = (bbox.x_min as f32 * scale).floor() as i32 - PADDING;
+        let top = (-bbox.y_max as f32 * scale).floor() as i32 - PADDING;
+        let right = (bbox.x_max as f32 * scale).ceil() as i32 + PADDING;
+        let bottom = (-bbox.y_min as f32 * scale).ceil() as i32 + PADDING;
+        let (width, height) = ((right - left) as u32, (bottom - top) as u32);
+
+        let mut rasterizer = Rasterizer::new(
+            width as usize,
+            height as usize,
+            scale,
+            (left as f32, top as f32),
+        );
+        face.outline_glyph(glyph, &mut rasterizer)?;
+        let coverage = rasterizer.coverage();
+        self.uploaded_bytes += coverage.len() as u64;
+
+        let (page, (x, y)) = self.allocate(device, width, height)?;
+        queue.write_texture(
+            wgpu::ImageCopyTexture {
+                texture: &self.pages[page].as_ref().unwrap().texture,
+                mip_level: 0,
+                origin: wgpu::Origin3d { x, y, z: 0 },
+                aspect: wgpu::TextureAspect::All,
+            },
+            &coverage,
+            wgpu::ImageDataLayout {
+                offset: 0,
+                bytes_per_row: std::num::NonZeroU32::new(width),
+                rows_per_image: std::num::NonZeroU32::new(height),
+            },
+            wgpu::Extent3d {
+                width,
+                height,
+                depth_or_array_layers: 1,
+            },
+        );
+
+        let texel = (PAGE_SIZE as f32).recip();
+        Some(AtlasGlyph {
+            page,
+            uv: [
+                x as f32 * texel,
+                y as f32 * texel,
+                (x + width) as f32 * texel,
+                (y + height) as f32 * texel,
+            ],
+            origin: [left as f32, top as f32],
+            size: [width as f32, height as f32],
+        })
+    }
+
+    /// Find room for a bitmap, opening a new page when the others are full.
+    fn allocate(
+        &mut self,
+        device: &wgpu::Device,
+        width: u32,
+        height: u32,
+    ) -> Option<(usize, (u32, u32))> {
+        for (index, page) in self.pages.iter_mut().enumerate() {
+            if let Some(position) = page
+                .as_mut()
+                .and_then(|page| page.packer.allocate(width, height))
+            {
+                return Some((index, position));
+            }
+        }
+
+        let mut page = self.create_page(device);
+        let position = page.packer.allocate(width, height)?;
+        let index = match self.pages.iter().position(Option::is_none) {
+            Some(index) => index,
+            None => {
+                self.pages.push(None);
+                self.pages.len() - 1
+            }
+        };
+        self.pages[index] = Some(page);
+        Some((index, position))
+    }
+
+    fn create_page(&self, device: &wgpu::Device) -> AtlasPage {
+        let texture = device.create_texture(&wgpu::TextureDescriptor {
+            label: Some("Glyph Atlas Page"),
+            size: wgpu::Extent3d {
+                width: PAGE_SIZE,
+                height: PAGE_SIZE,
+                depth_or_array_layers: 1,
+            },
+            mip_level_count: 1,
+            sample_count: 1,
+            dimension: wgpu::TextureDimension::D2,
+            format: wgpu::TextureFormat::R8Unorm,
+            usage: wgpu::TextureUsages::TEXTURE_BINDING | wgpu::TextureUsages::COPY_DST,
+        });
+        let view = texture.create_view(&wgpu::TextureViewDescriptor::default());
+        let bind_group = device.create_bind_group(&wgpu::BindGroupDescriptor {
+            layout: &self.bind_group_layout,
+            entries: &[
+                wgpu::BindGroupEntry {
+                    binding: 0,
+                    resource: wgpu::BindingResource::TextureView(&view),
+                },
+                wgpu::BindGroupEntry {
+                    binding: 1,
+                    resource: wgpu::BindingResource::Sampler(&self.sampler),
+                },
+            ],
+            label: Some("Glyph Atlas Bind Group"),
+        });
+
+        AtlasPage {
+            texture,
+            bind_group,
+            packer: ShelfPacker::new(),
+            last_used: self.frame,
+        }
+    }
+
+    /// End a frame, evicting the least recently used pages while the atlas
+    /// holds more than `max_bytes`. Pages used by the frame that just ended
+    /// are kept, so a frame never loses glyphs it placed.
+    pub(crate) fn end_frame(&mut self, max_bytes: Option<usize>) {
+        if let Some(max_bytes) = max_bytes {
+            let mut resident = self.pages.iter().flatten().count() * PAGE_BYTES;
+            while resident > max_bytes {
+                let oldest = self
+                    .pages
+                    .iter()
+                    .enumerate()
+                    .filter_map(|(index, page)| Some((index, page.as_ref()?.last_used)))
+                    .filter(|(_, last_used)| *last_used < self.frame)
+                    .min_by_key(|(_, last_used)| *last_used);
+                let index = match oldest {
+                    Some((index, _)) => index,
+                    None => break,
+                };
+                self.pages[index] = None;
+                self.glyphs
+                    .retain(|_, entry| entry.map_or(true, |entry| entry.page != index));
+                self.evictions += 1;
+                self.generation += 1;
+                resident -= PAGE_BYTES;
+            }
+        }
+        self.frame += 1;
+    }
+
+    /// Drop every page and rasterized glyph.
+    pub(crate) fn clear(&mut self) {
+        self.pages.clear();
+        self.glyphs.clear();
+        self.generation += 1;
+    }
+}
+
+fn create_pipeline(
+    device: &wgpu::Device,
+    uniform_bind_group_layout: &wgpu::BindGroupLayout,
+    bind_group_layout: &wgpu::BindGroupLayout,
+    format: wgpu::TextureFormat,
+    sample_count: u32,
+) -> wgpu::RenderPipeline {
+    let shader = device.create_shader_module(&wgpu::ShaderModuleDescriptor {
+        label: Some("Glyph Atlas Shader"),
+        source: wgpu::ShaderSource::Wgsl(include_str!("atlas.wgsl").into()),
+    });
+
+    let pipeline_layout = device.create_pipeline_layout(&wgpu::PipelineLayoutDescriptor {
+        label: Some("Glyph Atlas Pipeline Layout"),
+        bind_group_layouts: &[uniform_bind_group_layout, bind_group_layout],
+        push_constant_ranges: &[],
+    });
+
+    device.create_render_pipeline(&wgpu::RenderPipelineDescriptor {
+        label: Some("Glyph Atlas Pipeline"),
+        layout: Some(&pipeline_layout),
+        vertex: wgpu::VertexState {
+            module: &shader,
+            entry_point: "main",
+            buffers: &[GlyphInstance::desc()],
+        },
+        fragment: Some(wgpu::FragmentState {
+            module: &shader,
+            entry_point: "main",
+            targets: &[wgpu::ColorTargetState {
+                format,
+                blend: Some(PREMULTIPLIED_BLEND),
+                write_mask: wgpu::ColorWrites::ALL,
+            }],
+        }),
+        primitive: wgpu::PrimitiveState {
+            // Quads are generated from the vertex index.
+            topology: wgpu::PrimitiveTopology::TriangleStrip,
+            strip_index_format: None,
+            front_face: wgpu::FrontFace::Ccw,
+            cull_mode: None,
+            polygon_mode: wgpu::PolygonMode::Fill,
+            clamp_depth: false,
+            conservative: false,
+        },
+        depth_stencil: None,
+        multisample: wgpu::MultisampleState {
+            count: sample_count,
+            mask: !0,
+            alpha_to_coverage_enabled: false,
+        },
+    })
+}
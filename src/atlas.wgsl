@@ -0,0 +1,49 @@
+// glyph atlas shader
+
+[[block]]
+struct Uniforms {
+    view_proj: mat4x4<f32>;
+};
+[[group(0), binding(0)]]
+var<uniform> uniforms: Uniforms;
+
+[[group(1), binding(0)]]
+var atlas: texture_2d<f32>;
+[[group(1), binding(1)]]
+var atlas_sampler: sampler;
+
+// 2D affine transform of the unit quad, followed by the glyph's rectangle in the atlas
+struct InstanceInput {
+    [[location(2)]] transform_x: vec2<f32>;
+    [[location(3)]] transform_y: vec2<f32>;
+    [[location(4)]] translation: vec2<f32>;
+    // Linear, converted from sRGB when the instance was made
+    [[location(5)]] color: vec4<f32>;
+    [[location(6)]] uv: vec4<f32>;
+};
+
+struct VertexOutput {
+    [[builtin(position)]] clip_position: vec4<f32>;
+    [[location(0)]] color: vec4<f32>;
+    [[location(1)]] uv: vec2<f32>;
+};
+
+[[stage(vertex)]]
+fn main([[builtin(vertex_index)]] vertex_index: u32, instance: InstanceInput) -> VertexOutput {
+    // Triangle strip over the corners (0, 0), (1, 0), (0, 1), (1, 1)
+    let corner = vec2<f32>(f32(vertex_index & 1u), f32(vertex_index >> 1u));
+    let position = instance.transform_x * corner.x
+        + instance.transform_y * corner.y
+        + instance.translation;
+    var out: VertexOutput;
+    out.color = instance.color;
+    out.uv = mix(instance.uv.xy, instance.uv.zw, corner);
+    out.clip_position = uniforms.view_proj * vec4<f32>(position, 0.0, 1.0);
+    return out;
+}
+
+[[stage(fragment)]]
+fn main(in: VertexOutput) -> [[location(0)]] vec4<f32> {
+    let coverage = textureSample(atlas, atlas_sampler, in.uv).r;
+    return vec4<f32>(in.color.rgb, in.color.a * coverage);
+}
@@ -0,0 +1,365 @@
+// Compositing of layers rendered into textures, and clearing of parts of a target
+
+use crate::Instance;
+use std::sync::atomic::{AtomicU64, Ordering};
+
+/// A layer rendered into a texture, with premultiplied alpha.
+pub(crate) struct LayerTexture {
+    /// Unique for every texture ever created, unlike its address.
+    id: u64,
+    #[allow(dead_code)]
+    texture: wgpu::Texture,
+    view: wgpu::TextureView,
+    bind_group: wgpu::BindGroup,
+}
+
+impl LayerTexture {
+    pub(crate) fn id(&self) -> u64 {
+        self.id
+    }
+
+    pub(crate) fn view(&self) -> &wgpu::TextureView {
+        &self.view
+    }
+
+    pub(crate) fn bind_group(&self) -> &wgpu::BindGroup {
+        &self.bind_group
+    }
+}
+
+/// Pipeline drawing layer textures as quads.
+pub(crate) struct Compositor {
+    /// Created on first use, as painters without cached layers never need it.
+    pipeline: Option<wgpu::RenderPipeline>,
+    bind_group_layout: wgpu::BindGroupLayout,
+    sampler: wgpu::Sampler,
+    /// Created on first use, as only painters presenting separately need it.
+    present_pipeline: Option<wgpu::RenderPipeline>,
+}
+
+impl Compositor {
+    pub(crate) fn new(device: &wgpu::Device) -> Self {
+        let bind_group_layout = device.create_bind_group_layout(&wgpu::BindGroupLayoutDescriptor {
+            entries: &[
+                wgpu::BindGroupLayoutEntry {
+                    binding: 0,
+                    visibility: wgpu::ShaderStages::FRAGMENT,
+                    ty: wgpu::BindingType::Texture {
+                        sample_type: wgpu::TextureSampleType::Float { filterable: true },
+                        view_dimension: wgpu::TextureViewDimension::D2,
+                        multisampled: false,
+                    },
+                    count: None,
+                },
+                wgpu::BindGroupLayoutEntry {
+                    binding: 1,
+                    visibility: wgpu::ShaderStages::FRAGMENT,
+                    ty: wgpu::BindingType::Sampler {
+                        filtering: true,
+                        comparison: false,
+                    },
+                    count: None,
+                },
+            ],
+            label: Some("Layer Bind Group Layout"),
+        });
+
+        let sampler = device.create_sampler(&wgpu::SamplerDescriptor {
+            label: Some("Layer Sampler"),
+            address_mode_u: wgpu::AddressMode::ClampToEdge,
+            address_mode_v: wgpu::AddressMode::ClampToEdge,
+            address_mode_w: wgpu::AddressMode::ClampToEdge,
+            mag_filter: wgpu::FilterMode::Linear,
+            min_filter: wgpu::FilterMode::Linear,
+            mipmap_filter: wgpu::FilterMode::Nearest,
+            ..Default::default()
+        });
+
+        Self {
+            pipeline: None,
+            bind_group_layout,
+            sampler,
+            present_pipeline: None,
+        }
+    }
+
+    /// The pipeline created by [`Compositor::create_pipeline`].
+    pub(crate) fn pipeline(&self) -> &wgpu::RenderPipeline {
+        self.pipeline
+            .as_ref()
+            .expect("compositor pipeline used before it was created")
+    }
+
+    /// Create the pipeline if it does not exist yet.
+    pub(crate) fn create_pipeline(
+        &mut self,
+        device: &wgpu::Device,
+        uniform_bind_group_layout: &wgpu::BindGroupLayout,
+        format: wgpu::TextureFormat,
+        sample_count: u32,
+    ) {
+        if self.pipeline.is_none() {
+            self.pipeline = Some(create_pipeline(
+                device,
+                uniform_bind_group_layout,
+                &self.bind_group_layout,
+                format,
+                sample_count,
+            ));
+        }
+    }
+
+    /// Pipeline copying a texture made by [`Compositor::create_target`] onto a
+    /// single sampled target of the same size, with the texture bound to group 0.
+    pub(crate) fn present_pipeline(
+        &mut self,
+        device: &wgpu::Device,
+        format: wgpu::TextureFormat,
+    ) -> &wgpu::RenderPipeline {
+        let bind_group_layout = &self.bind_group_layout;
+        self.present_pipeline
+            .get_or_insert_with(|| create_present_pipeline(device, bind_group_layout, format))
+    }
+
+    /// Drop the pipeline, to be created again for a different sample count.
+    /// Layer textures stay valid.
+    pub(crate) fn reset_pipeline(&mut self) {
+        self.pipeline = None;
+    }
+
+    /// Create a texture to render a layer into and composite it from.
+    pub(crate) fn create_target(
+        &self,
+        device: &wgpu::Device,
+        format: wgpu::TextureFormat,
+        width: u32,
+        height: u32,
+    ) -> LayerTexture {
+        self.create_texture(
+            device,
+            format,
+            width,
+            height,
+            wgpu::TextureUsages::RENDER_ATTACHMENT,
+        )
+    }
+
+    /// Create a texture for a compute shader to write into and to composite from.
+    pub(crate) fn create_storage_target(
+        &self,
+        device: &wgpu::Device,
+        format: wgpu::TextureFormat,
+        width: u32,
+        height: u32,
+    ) -> LayerTexture {
+        self.create_texture(
+            device,
+            format,
+            width,
+            height,
+            wgpu::TextureUsages::STORAGE_BINDING,
+        )
+    }
+
+    /// Create a texture with `usage`, bound for compositing.
+    fn create_texture(
+        &self,
+        device: &wgpu::Device,
+        format: wgpu::TextureFormat,
+        width: u32,
+        height: u32,
+        usage: wgpu::TextureUsages,
+    ) -> LayerTexture {
+        static NEXT_ID: AtomicU64 = AtomicU64::new(0);
+
+        let texture = device.create_texture(&wgpu::TextureDescriptor {
+            label: Some("Layer Texture"),
+            size: wgpu::Extent3d {
+                width,
+                height,
+                depth_or_array_layers: 1,
+            },
+            mip_level_count: 1,
+            sample_count: 1,
+            dimension: wgpu::TextureDimension::D2,
+            format,
+            usage: usage | wgpu::TextureUsages::TEXTURE_BINDING,
+        });
+        let view = texture.create_view(&wgpu::TextureViewDescriptor::default());
+        let bind_group = device.create_bind_group(&wgpu::BindGroupDescriptor {
+            layout: &self.bind_group_layout,
+            entries: &[
+                wgpu::BindGroupEntry {
+                    binding: 0,
+                    resource: wgpu::BindingResource::TextureView(&view),
+                },
+                wgpu::BindGroupEntry {
+                    binding: 1,
+                    resource: wgpu::BindingResource::Sampler(&self.sampler),
+                },
+            ],
+            label: Some("Layer Bind Group"),
+        });
+
+        LayerTexture {
+            id: NEXT_ID.fetch_add(1, Ordering::Relaxed),
+            texture,
+            view,
+            bind_group,
+        }
+    }
+}
+
+fn create_pipeline(
+    device: &wgpu::Device,
+    uniform_bind_group_layout: &wgpu::BindGroupLayout,
+    bind_group_layout: &wgpu::BindGroupLayout,
+    format: wgpu::TextureFormat,
+    sample_count: u32,
+) -> wgpu::RenderPipeline {
+    let shader = device.create_shader_module(&wgpu::ShaderModuleDescriptor {
+        label: Some("Layer Shader"),
+        source: wgpu::ShaderSource::Wgsl(include_str!("composite.wgsl").into()),
+    });
+
+    let pipeline_layout = device.create_pipeline_layout(&wgpu::PipelineLayoutDescriptor {
+        label: Some("Layer Pipeline Layout"),
+        bind_group_layouts: &[uniform_bind_group_layout, bind_group_layout],
+        push_constant_ranges: &[],
+    });
+
+    device.create_render_pipeline(&wgpu::RenderPipelineDescriptor {
+        label: Some("Layer Pipeline"),
+        layout: Some(&pipeline_layout),
+        vertex: wgpu::VertexState {
+            module: &shader,
+            entry_point: "main",
+            buffers: &[Instance::desc()],
+        },
+        fragment: Some(wgpu::FragmentState {
+            module: &shader,
+            entry_point: "main",
+            targets: &[wgpu::ColorTargetState {
+                format,
+                blend: Some(wgpu::BlendState::PREMULTIPLIED_ALPHA_BLENDING),
+                write_mask: wgpu::ColorWrites::ALL,
+            }],
+        }),
+        primitive: wgpu::PrimitiveState {
+            // Quads are generated from the vertex index.
+            topology: wgpu::PrimitiveTopology::TriangleStrip,
+            strip_index_format: None,
+            front_face: wgpu::FrontFace::Ccw,
+            cull_mode: None,
+            polygon_mode: wgpu::PolygonMode::Fill,
+            clamp_depth: false,
+            conservative: false,
+        },
+        depth_stencil: None,
+        multisample: wgpu::MultisampleState {
+            count: sample_count,
+            mask: !0,
+            alpha_to_coverage_enabled: false,
+        },
+    })
+}
+
+fn create_present_pipeline(
+    device: &wgpu::Device,
+    bind_group_layout: &wgpu::BindGroupLayout,
+    format: wgpu::TextureFormat,
+) -> wgpu::RenderPipeline {
+    let shader = device.create_shader_module(&wgpu::ShaderModuleDescriptor {
+        label: Some("Present Shader"),
+        source: wgpu::ShaderSource::Wgsl(include_str!("present.wgsl").into()),
+    });
+
+    let pipeline_layout = device.create_pipeline_layout(&wgpu::PipelineLayoutDescriptor {
+        label: Some("Present Pipeline Layout"),
+        bind_group_layouts: &[bind_group_layout],
+        push_constant_ranges: &[],
+    });
+
+    device.create_render_pipeline(&wgpu::RenderPipelineDescriptor {
+        label: Some("Present Pipeline"),
+        layout: Some(&pipeline_layout),
+        vertex: wgpu::VertexState {
+            module: &shader,
+            entry_point: "main",
+            buffers: &[],
+        },
+        fragment: Some(wgpu::FragmentState {
+            module: &shader,
+            entry_point: "main",
+            targets: &[wgpu::ColorTargetState {
+                format,
+                blend: None,
+                write_mask: wgpu::ColorWrites::ALL,
+            }],
+        }),
+        primitive: wgpu::PrimitiveState {
+            topology: wgpu::PrimitiveTopology::TriangleList,
+            strip_index_format: None,
+            front_face: wgpu::FrontFace::Ccw,
+            cull_mode: None,
+            polygon_mode: wgpu::PolygonMode::Fill,
+            clamp_depth: false,
+            conservative: false,
+        },
+        depth_stencil: None,
+        multisample: wgpu::MultisampleState::default(),
+    })
+}
+
+/// Pipeline replacing everything inside the scissor rectangle with transparent
+/// black, for clearing part of a target.
+pub(crate) fn create_clear_pipeline(
+    device: &wgpu::Device,
+    format: wgpu::TextureFormat,
+    sample_count: u32,
+) -> wgpu::RenderPipeline {
+    let shader = device.create_shader_module(&wgpu::ShaderModuleDescriptor {
+        label: Some("Clear Shader"),
+        source: wgpu::ShaderSource::Wgsl(include_str!("clear.wgsl").into()),
+    });
+
+    let pipeline_layout = device.create_pipeline_layout(&wgpu::PipelineLayoutDescriptor {
+        label: Some("Clear Pipeline Layout"),
+        bind_group_layouts: &[],
+        push_constant_ranges: &[],
+    });
+
+    device.create_render_pipeline(&wgpu::RenderPipelineDescriptor {
+        label: Some("Clear Pipeline"),
+        layout: Some(&pipeline_layout),
+        vertex: wgpu::VertexState {
+            module: &shader,
+            entry_point: "main",
+            buffers: &[],
+        },
+        fragment: Some(wgpu::FragmentState {
+            module: &shader,
+            entry_point: "main",
+            targets: &[wgpu::ColorTargetState {
+                format,
+                blend: None,
+                write_mask: wgpu::ColorWrites::ALL,
+            }],
+        }),
+        primitive: wgpu::PrimitiveState {
+            topology: wgpu::PrimitiveTopology::TriangleList,
+            strip_index_format: None,
+            front_face: wgpu::FrontFace::Ccw,
+            cull_mode: None,
+            polygon_mode: wgpu::PolygonMode::Fill,
+            clamp_depth: false,
+            conservative: false,
+        },
+        depth_stencil: None,
+        multisample: wgpu::MultisampleState {
+            count: sample_count,
+            mask: !0,
+            alpha_to_coverage_enabled: false,
+        },
+    })
+}
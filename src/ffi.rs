@@ -46,6 +46,34 @@ pub unsafe extern "C" fn bfr_painter_from_xlib_window(
     Box::into_raw(painter)
 }
 
+/// create a painter drawing into an offscreen texture, null if there is no adapter
+#[no_mangle]
+pub unsafe extern "C" fn bfr_painter_new_headless(
+    width: u32,
+    height: u32,
+    backend: u32,
+) -> *mut Painter {
+    match pollster::block_on(Painter::new_headless(
+        (width, height),
+        Backends::from_bits(backend).unwrap(),
+    )) {
+        Some(painter) => Box::into_raw(Box::new(painter)),
+        None => std::ptr::null_mut(),
+    }
+}
+
+/// read the oldest unread frame of a headless painter into `len` bytes of RGBA pixels
+#[no_mangle]
+pub unsafe extern "C" fn bfr_painter_read_pixels(
+    painter: *mut Painter,
+    pixels: *mut u8,
+    len: usize,
+    wait: bool,
+) -> bool {
+    let pixels = &mut *std::ptr::slice_from_raw_parts_mut(pixels, len);
+    (*painter).read_pixels(pixels, wait)
+}
+
 /// free painter
 #[no_mangle]
 pub unsafe extern "C" fn bfr_painter_free(painter: *mut Painter) {
@@ -121,6 +149,12 @@ pub unsafe extern "C" fn bfr_pathbuilder_build(
     *path = Box::into_raw(newpath);
 }
 
+/// get the content hash of a path
+#[no_mangle]
+pub unsafe extern "C" fn bfr_path_get_id(path: *const Path) -> u64 {
+    (*path).id().0
+}
+
 #[no_mangle]
 pub unsafe extern "C" fn bfr_pathbuilder_scale(pathbuilder: *mut PathBuilder, x: f32, y: f32) {
     (*pathbuilder).scale(x, y);
@@ -322,6 +356,7 @@ pub enum BufroLineJoin {
     BufroLineJoinBevel,
 }
 
+#[derive(Clone, Copy)]
 #[repr(C)]
 pub struct BufroStrokeOptions {
     /// What cap to use at the start of each sub-path.
@@ -394,6 +429,126 @@ pub unsafe extern "C" fn bfr_painter_circle(
     (*painter).circle(x, y, radius, std::mem::transmute(color));
 }
 
+/// stroke circle on painter
+#[no_mangle]
+pub unsafe extern "C" fn bfr_painter_stroke_circle(
+    painter: *mut Painter,
+    x: f32,
+    y: f32,
+    radius: f32,
+    color: BufroColor,
+    line_width: f32,
+) {
+    (*painter).stroke_circle(x, y, radius, std::mem::transmute(color), line_width);
+}
+
+/// rounded rectangle on painter
+#[no_mangle]
+pub unsafe extern "C" fn bfr_painter_rounded_rectangle(
+    painter: *mut Painter,
+    x: f32,
+    y: f32,
+    width: f32,
+    height: f32,
+    radius: f32,
+    color: BufroColor,
+) {
+    (*painter).rounded_rectangle(x, y, width, height, radius, std::mem::transmute(color));
+}
+
+/// stroke rounded rectangle on painter
+#[no_mangle]
+pub unsafe extern "C" fn bfr_painter_stroke_rounded_rectangle(
+    painter: *mut Painter,
+    x: f32,
+    y: f32,
+    width: f32,
+    height: f32,
+    radius: f32,
+    color: BufroColor,
+    line_width: f32,
+) {
+    (*painter).stroke_rounded_rectangle(
+        x,
+        y,
+        width,
+        height,
+        radius,
+        std::mem::transmute(color),
+        line_width,
+    );
+}
+
+/// draw circles on painter with the analytic shape pipeline, or tessellate them
+#[no_mangle]
+pub unsafe extern "C" fn bfr_painter_set_analytic_circles(painter: *mut Painter, enabled: bool) {
+    (*painter).set_shape_mode(match enabled {
+        true => ShapeMode::Analytic,
+        false => ShapeMode::Tessellated,
+    });
+}
+
+/// fill paths on painter with the compute rasterizer, or tessellate them
+#[no_mangle]
+pub unsafe extern "C" fn bfr_painter_set_compute_fills(painter: *mut Painter, enabled: bool) {
+    (*painter).set_path_rasterizer(match enabled {
+        true => PathRasterizer::Compute,
+        false => PathRasterizer::Tessellated,
+    });
+}
+
+/// begin recording a layer on painter
+#[no_mangle]
+pub unsafe extern "C" fn bfr_painter_begin_layer(painter: *mut Painter) {
+    (*painter).begin_layer();
+}
+
+/// end recording a layer on painter
+#[no_mangle]
+pub unsafe extern "C" fn bfr_painter_end_layer(painter: *mut Painter) -> *mut Layer {
+    Box::into_raw(Box::new((*painter).end_layer()))
+}
+
+/// draw layer on painter
+#[no_mangle]
+pub unsafe extern "C" fn bfr_painter_draw_layer(painter: *mut Painter, layer: *const Layer) {
+    (*painter).draw_layer(&*layer);
+}
+
+/// free layer
+#[no_mangle]
+pub unsafe extern "C" fn bfr_layer_free(layer: *mut Layer) {
+    Box::from_raw(layer);
+}
+
+/// render layer into a texture on painter
+#[no_mangle]
+pub unsafe extern "C" fn bfr_painter_render_layer(
+    painter: *mut Painter,
+    layer: *const Layer,
+    width: u32,
+    height: u32,
+) -> *mut CachedLayer {
+    Box::into_raw(Box::new((*painter).render_layer(&*layer, width, height)))
+}
+
+/// draw cached layer on painter
+#[no_mangle]
+pub unsafe extern "C" fn bfr_painter_draw_cached_layer(
+    painter: *mut Painter,
+    layer: *const CachedLayer,
+    x: f32,
+    y: f32,
+) {
+    (*painter).draw_cached_layer(&*layer, x, y);
+}
+
+/// free cached layer
+#[no_mangle]
+pub unsafe extern "C" fn bfr_cached_layer_free(layer: *mut CachedLayer) {
+    Box::from_raw(layer);
+}
+
 /// get buffer info string from painter
 #[no_mangle]
 pub unsafe extern "C" fn bfr_painter_get_buffer_info_string(
@@ -403,12 +558,314 @@ pub unsafe extern "C" fn bfr_painter_get_buffer_info_string(
     CString::new(info).unwrap().into_raw()
 }
 
+/// get the cache, per frame and memory counters of painter
+#[no_mangle]
+pub unsafe extern "C" fn bfr_painter_get_stats(painter: *const Painter) -> PainterStats {
+    (*painter).stats()
+}
+
+#[repr(C)]
+pub enum BufroPresentMode {
+    BufroPresentModeImmediate,
+    BufroPresentModeMailbox,
+    BufroPresentModeFifo,
+}
+
+/// set sample count and present mode on painter
+#[no_mangle]
+pub unsafe extern "C" fn bfr_painter_set_config(
+    painter: *mut Painter,
+    sample_count: u32,
+    present_mode: BufroPresentMode,
+) {
+    let present_mode = match present_mode {
+        BufroPresentMode::BufroPresentModeImmediate => PresentMode::Immediate,
+        BufroPresentMode::BufroPresentModeMailbox => PresentMode::Mailbox,
+        BufroPresentMode::BufroPresentModeFifo => PresentMode::Fifo,
+    };
+    (*painter).set_config(PainterConfig {
+        sample_count,
+        present_mode,
+    });
+}
+
+/// redraw only what changed since the last frame on painter
+#[no_mangle]
+pub unsafe extern "C" fn bfr_painter_set_damage_tracking(painter: *mut Painter, enabled: bool) {
+    (*painter).set_damage_tracking(enabled);
+}
+
+/// profile the frames of painter
+#[no_mangle]
+pub unsafe extern "C" fn bfr_painter_set_profiling(painter: *mut Painter, enabled: bool) {
+    (*painter).set_profiling(enabled);
+}
+
+/// write the profiled frames of painter as chrome trace json to path
+#[no_mangle]
+pub unsafe extern "C" fn bfr_painter_write_chrome_trace(
+    painter: *const Painter,
+    path: *const c_char,
+) -> u8 {
+    let path = match CStr::from_ptr(path).to_str() {
+        Ok(path) => path,
+        Err(_) => return 1,
+    };
+    let mut file = match std::fs::File::create(path) {
+        Ok(file) => std::io::BufWriter::new(file),
+        Err(_) => return 1,
+    };
+    match (*painter).write_chrome_trace(&mut file) {
+        Ok(()) => 0,
+        Err(_) => 1,
+    }
+}
+
 /// clear painter
 #[no_mangle]
 pub unsafe extern "C" fn bfr_painter_clear(painter: *mut Painter) {
     (*painter).clear();
 }
 
+/// create every pipeline of painter now instead of on first use
+#[no_mangle]
+pub unsafe extern "C" fn bfr_painter_create_pipelines(painter: *mut Painter) {
+    (*painter).create_pipelines();
+}
+
+/// one command of a command stream submitted with bfr_painter_submit
+#[repr(C)]
+pub enum BufroCmd {
+    BufroCmdSave,
+    BufroCmdRestore,
+    BufroCmdReset,
+    BufroCmdTranslate {
+        x: f32,
+        y: f32,
+    },
+    BufroCmdScale {
+        x: f32,
+        y: f32,
+    },
+    BufroCmdRotate {
+        angle: f32,
+    },
+    BufroCmdRectangle {
+        x: f32,
+        y: f32,
+        width: f32,
+        height: f32,
+        color: BufroColor,
+    },
+    BufroCmdCircle {
+        x: f32,
+        y: f32,
+        radius: f32,
+        color: BufroColor,
+    },
+    BufroCmdFillPath {
+        path: *const Path,
+        color: BufroColor,
+    },
+    BufroCmdStrokePath {
+        path: *const Path,
+        color: BufroColor,
+        options: BufroStrokeOptions,
+    },
+    /// `len` bytes of UTF-8 `text`, not null terminated. The command is skipped
+    /// if `text` isn't valid UTF-8
+    BufroCmdFillText {
+        font: *const BufroFont,
+        text: *const c_char,
+        len: usize,
+        x: f32,
+        y: f32,
+        size: f32,
+        color: BufroColor,
+        wrap_limit: usize,
+    },
+    /// `len` bytes of UTF-8 `text`, not null terminated. The command is skipped
+    /// if `text` isn't valid UTF-8
+    BufroCmdStrokeText {
+        font: *const BufroFont,
+        text: *const c_char,
+        len: usize,
+        x: f32,
+        y: f32,
+        size: f32,
+        color: BufroColor,
+        options: BufroStrokeOptions,
+        wrap_limit: usize,
+    },
+}
+
+/// Text of a command, or `None` if it isn't valid UTF-8. `text` may be null
+/// when `len` is 0.
+unsafe fn command_text<'a>(text: *const c_char, len: usize) -> Option<&'a str> {
+    if len == 0 {
+        return Some("");
+    }
+    std::str::from_utf8(std::slice::from_raw_parts(text as *const u8, len)).ok()
+}
+
+/// A command stream. `commands` may be null when `len` is 0.
+unsafe fn commands_of<'a>(commands: *const BufroCmd, len: usize) -> &'a [BufroCmd] {
+    if len == 0 {
+        return &[];
+    }
+    std::slice::from_raw_parts(commands, len)
+}
+
+/// Run BufroCmd commands on anything with the drawing methods of a painter.
+macro_rules! run_commands {
+    ($target:expr, $commands:expr) => {
+        for command in $commands.iter() {
+            match *command {
+                BufroCmd::BufroCmdSave => $target.save(),
+                BufroCmd::BufroCmdRestore => $target.restore(),
+                BufroCmd::BufroCmdReset => $target.reset(),
+                BufroCmd::BufroCmdTranslate { x, y } => $target.translate(x, y),
+                BufroCmd::BufroCmdScale { x, y } => $target.scale(x, y),
+                BufroCmd::BufroCmdRotate { angle } => $target.rotate(angle),
+                BufroCmd::BufroCmdRectangle {
+                    x,
+                    y,
+                    width,
+                    height,
+                    color,
+                } => $target.rectangle(x, y, width, height, std::mem::transmute(color)),
+                BufroCmd::BufroCmdCircle {
+                    x,
+                    y,
+                    radius,
+                    color,
+                } => $target.circle(x, y, radius, std::mem::transmute(color)),
+                BufroCmd::BufroCmdFillPath { path, color } => {
+                    $target.fill_path(&*path, std::mem::transmute(color))
+                }
+                BufroCmd::BufroCmdStrokePath {
+                    path,
+                    color,
+                    options,
+                } => $target.stroke_path(
+                    &*path,
+                    std::mem::transmute(color),
+                    std::mem::transmute(options),
+                ),
+                BufroCmd::BufroCmdFillText {
+                    font,
+                    text,
+                    len,
+                    x,
+                    y,
+                    size,
+                    color,
+                    wrap_limit,
+                } => {
+                    if let Some(text) = command_text(text, len) {
+                        $target.fill_text(
+                            &(*font).0,
+                            text,
+                            x,
+                            y,
+                            size,
+                            std::mem::transmute(color),
+                            match wrap_limit {
+                                0 => None,
+                                _ => Some(wrap_limit),
+                            },
+                        );
+                    }
+                }
+                BufroCmd::BufroCmdStrokeText {
+                    font,
+                    text,
+                    len,
+                    x,
+                    y,
+                    size,
+                    color,
+                    options,
+                    wrap_limit,
+                } => {
+                    if let Some(text) = command_text(text, len) {
+                        $target.stroke_text(
+                            &(*font).0,
+                            text,
+                            x,
+                            y,
+                            size,
+                            std::mem::transmute(color),
+                            std::mem::transmute(options),
+                            match wrap_limit {
+                                0 => None,
+                                _ => Some(wrap_limit),
+                            },
+                        );
+                    }
+                }
+            }
+        }
+    };
+}
+
+/// run `len` commands on painter in one call, as if each was its own bfr_painter_* call
+#[no_mangle]
+pub unsafe extern "C" fn bfr_painter_submit(
+    painter: *mut Painter,
+    commands: *const BufroCmd,
+    len: usize,
+) {
+    let painter = &mut *painter;
+    let commands = commands_of(commands, len);
+    run_commands!(painter, commands);
+}
+
+/// make a recorder for painter, which can be filled on another thread
+#[no_mangle]
+pub unsafe extern "C" fn bfr_painter_recorder(painter: *mut Painter) -> *mut Recorder {
+    Box::into_raw(Box::new((*painter).recorder()))
+}
+
+/// run `len` commands on recorder, like bfr_painter_submit
+#[no_mangle]
+pub unsafe extern "C" fn bfr_recorder_submit(
+    recorder: *mut Recorder,
+    commands: *const BufroCmd,
+    len: usize,
+) {
+    let recorder = &mut *recorder;
+    let commands = commands_of(commands, len);
+    run_commands!(recorder, commands);
+}
+
+/// draw recorder on painter and free it
+#[no_mangle]
+pub unsafe extern "C" fn bfr_painter_draw_recorder(painter: *mut Painter, recorder: *mut Recorder) {
+    (*painter).draw_recorder(*Box::from_raw(recorder));
+}
+
+/// free recorder without drawing it
+#[no_mangle]
+pub unsafe extern "C" fn bfr_recorder_free(recorder: *mut Recorder) {
+    Box::from_raw(recorder);
+}
+
+/// draw and submit the frame of painter, to show with bfr_painter_present
+#[no_mangle]
+pub unsafe extern "C" fn bfr_painter_end_frame(painter: *mut Painter) {
+    (*painter).end_frame();
+}
+
+/// show the frame submitted by bfr_painter_end_frame on painter
+#[no_mangle]
+pub unsafe extern "C" fn bfr_painter_present(painter: *mut Painter) -> BufroFlushResult {
+    match (*painter).present() {
+        Ok(()) => BufroFlushResult::BufroFlushResultOk,
+        Err(e) => BufroFlushResult::from(e),
+    }
+}
+
 /// flush painter
 #[no_mangle]
 pub unsafe extern "C" fn bfr_painter_flush(painter: *mut Painter) -> BufroFlushResult {
@@ -438,6 +895,7 @@ impl From<wgpu::SurfaceError> for BufroFlushResult {
     }
 }
 
+#[derive(Clone, Copy)]
 #[repr(C)]
 pub struct BufroColor {
     pub r: f32,
@@ -462,3 +920,238 @@ pub unsafe extern "C" fn bfr_coloru8(r: u8, g: u8, b: u8, a: u8) -> BufroColor {
         a: a as f32 / 255.0,
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn recorder() -> Recorder {
+        Recorder {
+            commands: Vec::new(),
+            jobs: HashMap::new(),
+            cached: Arc::new(HashSet::new()),
+            version: 0,
+            transform: cgmath::Matrix4::identity(),
+            old_transforms: Vec::new(),
+            lookups: PainterStats::default(),
+            shape_mode: ShapeMode::default(),
+            path_rasterizer: PathRasterizer::default(),
+        }
+    }
+
+    /// The commands of a recorder, in a form that can be compared.
+    fn commands(recorder: &Recorder) -> Vec<String> {
+        recorder
+            .commands
+            .iter()
+            .map(|command| match command {
+                Command::RawGeometry { path, instance } => format!("{:?} {:?}", path, instance),
+                Command::AtlasGlyph { page, instance } => format!("{} {:?}", page, instance),
+                Command::Texture { texture, instance } => {
+                    format!("{} {:?}", texture.id(), instance)
+                }
+                Command::Shape { instance } => format!("{:?}", instance),
+                Command::RasterFill {
+                    path,
+                    instance,
+                    geometry,
+                } => format!("{:?} {:?} {:?}", path.id(), instance, geometry),
+            })
+            .collect()
+    }
+
+    /// Submit `stream` to one recorder and make the same calls with `direct`
+    /// on another, which must end up recording the same.
+    fn round_trip(stream: &[BufroCmd], direct: impl FnOnce(&mut Recorder)) -> Recorder {
+        let mut submitted = recorder();
+        unsafe { bfr_recorder_submit(&mut submitted, stream.as_ptr(), stream.len()) };
+        let mut expected = recorder();
+        direct(&mut expected);
+
+        assert_eq!(commands(&submitted), commands(&expected));
+        assert_eq!(submitted.transform, expected.transform);
+        assert_eq!(submitted.old_transforms, expected.old_transforms);
+        let jobs = |recorder: &Recorder| recorder.jobs.keys().cloned().collect::<HashSet<_>>();
+        assert_eq!(jobs(&submitted), jobs(&expected));
+        submitted
+    }
+
+    fn color() -> BufroColor {
+        BufroColor {
+            r: 0.2,
+            g: 0.4,
+            b: 0.6,
+            a: 0.8,
+        }
+    }
+
+    fn options() -> BufroStrokeOptions {
+        unsafe { std::mem::transmute(StrokeOptions::default().with_line_width(3.)) }
+    }
+
+    fn font() -> BufroFont {
+        BufroFont(Font::new(include_bytes!("../examples/Overpass-Black.ttf")).unwrap())
+    }
+
+    fn path() -> Path {
+        let mut builder = PathBuilder::new();
+        builder.move_to(0., 0.);
+        builder.line_to(10., 0.);
+        builder.line_to(10., 10.);
+        builder.close();
+        builder.build()
+    }
+
+    #[test]
+    fn transform_commands_round_trip() {
+        let stream = [
+            BufroCmd::BufroCmdTranslate { x: 4., y: 5. },
+            BufroCmd::BufroCmdSave,
+            BufroCmd::BufroCmdScale { x: 2., y: 3. },
+            BufroCmd::BufroCmdRotate { angle: 0.5 },
+            BufroCmd::BufroCmdSave,
+            BufroCmd::BufroCmdReset,
+            BufroCmd::BufroCmdRotate { angle: 1. },
+            BufroCmd::BufroCmdRestore,
+        ];
+        let recorder = round_trip(&stream, |recorder| {
+            recorder.translate(4., 5.);
+            recorder.save();
+            recorder.scale(2., 3.);
+            recorder.rotate(0.5);
+            recorder.save();
+            recorder.reset();
+            recorder.rotate(1.);
+            recorder.restore();
+        });
+        assert_eq!(recorder.old_transforms.len(), 1);
+    }
+
+    #[test]
+    fn shape_commands_round_trip() {
+        let stream = [
+            BufroCmd::BufroCmdRectangle {
+                x: 1.,
+                y: 2.,
+                width: 30.,
+                height: 40.,
+                color: color(),
+            },
+            BufroCmd::BufroCmdTranslate { x: 8., y: 0. },
+            BufroCmd::BufroCmdCircle {
+                x: 5.,
+                y: 6.,
+                radius: 7.,
+                color: color(),
+            },
+        ];
+        let recorder = round_trip(&stream, |recorder| {
+            let color = unsafe { std::mem::transmute(color()) };
+            recorder.rectangle(1., 2., 30., 40., color);
+            recorder.translate(8., 0.);
+            recorder.circle(5., 6., 7., color);
+        });
+        assert_eq!(recorder.commands.len(), 2);
+    }
+
+    #[test]
+    fn path_commands_round_trip() {
+        let path = path();
+        let stream = [
+            BufroCmd::BufroCmdFillPath {
+                path: &path,
+                color: color(),
+            },
+            BufroCmd::BufroCmdStrokePath {
+                path: &path,
+                color: color(),
+                options: options(),
+            },
+        ];
+        let recorder = round_trip(&stream, |recorder| {
+            let color = unsafe { std::mem::transmute(color()) };
+            recorder.fill_path(&path, color);
+            recorder.stroke_path(&path, color, unsafe { std::mem::transmute(options()) });
+        });
+        assert_eq!(recorder.commands.len(), 2);
+        assert_eq!(recorder.jobs.len(), 2);
+    }
+
+    #[test]
+    fn text_commands_round_trip() {
+        let font = font();
+        let text = "Hello,\nworld";
+        let stream = [
+            BufroCmd::BufroCmdFillText {
+                font: &font,
+                text: text.as_ptr() as *const c_char,
+                len: text.len(),
+                x: 10.,
+                y: 20.,
+                size: 16.,
+                color: color(),
+                wrap_limit: 0,
+            },
+            BufroCmd::BufroCmdStrokeText {
+                font: &font,
+                text: text.as_ptr() as *const c_char,
+                len: text.len(),
+                x: 10.,
+                y: 60.,
+                size: 16.,
+                color: color(),
+                options: options(),
+                wrap_limit: 4,
+            },
+        ];
+        let recorder = round_trip(&stream, |recorder| {
+            let color = unsafe { std::mem::transmute(color()) };
+            recorder.fill_text(&font.0, text, 10., 20., 16., color, None);
+            recorder.stroke_text(
+                &font.0,
+                text,
+                10.,
+                60.,
+                16.,
+                color,
+                unsafe { std::mem::transmute(options()) },
+                Some(4),
+            );
+        });
+        assert!(!recorder.commands.is_empty());
+    }
+
+    #[test]
+    fn empty_stream_without_pointer_is_accepted() {
+        round_trip(&[], |_| {});
+        let mut recorder = recorder();
+        unsafe { bfr_recorder_submit(&mut recorder, std::ptr::null(), 0) };
+        assert!(recorder.commands.is_empty());
+    }
+
+    #[test]
+    fn text_commands_check_their_text() {
+        let font = font();
+        let fill = |text: *const c_char, len| BufroCmd::BufroCmdFillText {
+            font: &font,
+            text,
+            len,
+            x: 0.,
+            y: 0.,
+            size: 16.,
+            color: color(),
+            wrap_limit: 0,
+        };
+        let invalid = [b'a', 0xff, b'b'];
+        let stream = [
+            // Empty text may come without a pointer.
+            fill(std::ptr::null(), 0),
+            fill(invalid.as_ptr() as *const c_char, invalid.len()),
+        ];
+        let recorder = round_trip(&stream, |recorder| {
+            let color = unsafe { std::mem::transmute(color()) };
+            recorder.fill_text(&font.0, "", 0., 0., 16., color, None);
+        });
+        assert!(recorder.commands.is_empty());
+    }
+}
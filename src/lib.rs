@@ -1,22 +1,31 @@
 use cgmath::SquareMatrix;
-use lyon::math::point;
 use ordered_float::OrderedFloat;
 use owned_ttf_parser::AsFaceRef;
 use std::collections::{HashMap, HashSet};
 use std::iter;
-use wgpu::util::DeviceExt;
+use std::ops::Range;
 
 use cgmath::Transform;
 
+mod atlas;
+mod composite;
 mod mem_align;
+mod profiler;
+mod raster;
+mod readback;
+mod shape;
+mod srgb;
+mod tessellation;
 
 use std::sync::Arc;
 
 pub mod ffi;
 
 pub use lyon::tessellation::FillOptions;
+pub use profiler::{FrameProfile, Span};
 
 pub use wgpu::Backends;
+pub use wgpu::PresentMode;
 pub use wgpu::SurfaceError;
 
 #[derive(Copy, Clone, Debug, PartialEq, Hash, Eq)]
@@ -193,7 +202,6 @@ impl Into<lyon::tessellation::StrokeOptions> for StrokeOptions {
 #[derive(Copy, Clone, Debug, bytemuck::Pod, bytemuck::Zeroable)]
 struct Vertex {
     position: [f32; 2],
-    color: [f32; 4],
 }
 
 impl Vertex {
@@ -201,18 +209,76 @@ impl Vertex {
         wgpu::VertexBufferLayout {
             array_stride: std::mem::size_of::<Vertex>() as wgpu::BufferAddress,
             step_mode: wgpu::VertexStepMode::Vertex,
-            attributes: &[
-                wgpu::VertexAttribute {
-                    offset: 0,
-                    shader_location: 0,
-                    format: wgpu::VertexFormat::Float32x2,
-                },
-                wgpu::VertexAttribute {
-                    offset: std::mem::size_of::<[f32; 2]>() as wgpu::BufferAddress,
-                    shader_location: 1,
-                    format: wgpu::VertexFormat::Float32x4,
-                },
+            attributes: &[wgpu::VertexAttribute {
+                offset: 0,
+                shader_location: 0,
+                format: wgpu::VertexFormat::Float32x2,
+            }],
+        }
+    }
+}
+
+/// Per-instance data, one for every drawn command. Consecutive commands that
+/// share a geometry buffer are submitted as a single instanced draw.
+///
+/// The transform is stored as a 2D affine matrix (the two basis columns followed
+/// by the translation); the projection lives in `Uniforms`. Color is supplied
+/// per instance so cached geometry only depends on shape, already converted to
+/// linear unorm16 so the shaders do not convert it for every vertex.
+#[repr(C)]
+#[derive(Copy, Clone, Debug, bytemuck::Pod, bytemuck::Zeroable)]
+struct Instance {
+    transform: [[f32; 2]; 3],
+    color: [u16; 4],
+}
+
+impl Instance {
+    fn new(transform: &cgmath::Matrix4<f32>, color: Color) -> Self {
+        Self {
+            transform: [
+                [transform.x.x, transform.x.y],
+                [transform.y.x, transform.y.y],
+                [transform.w.x, transform.w.y],
+            ],
+            color: srgb::linear_unorm16(color),
+        }
+    }
+
+    /// Place unit geometry: scale it by `(width, height)` and move it to `(x, y)`
+    /// before applying `transform`.
+    fn placed(
+        transform: &cgmath::Matrix4<f32>,
+        x: f32,
+        y: f32,
+        width: f32,
+        height: f32,
+        color: Color,
+    ) -> Self {
+        Self {
+            transform: [
+                [transform.x.x * width, transform.x.y * width],
+                [transform.y.x * height, transform.y.y * height],
+                [
+                    transform.w.x + transform.x.x * x + transform.y.x * y,
+                    transform.w.y + transform.x.y * x + transform.y.y * y,
+                ],
             ],
+            color: srgb::linear_unorm16(color),
+        }
+    }
+
+    const ATTRIBUTES: [wgpu::VertexAttribute; 4] = wgpu::vertex_attr_array![
+        2 => Float32x2,
+        3 => Float32x2,
+        4 => Float32x2,
+        5 => Unorm16x4,
+    ];
+
+    fn desc<'a>() -> wgpu::VertexBufferLayout<'a> {
+        wgpu::VertexBufferLayout {
+            array_stride: std::mem::size_of::<Instance>() as wgpu::BufferAddress,
+            step_mode: wgpu::VertexStepMode::Instance,
+            attributes: &Self::ATTRIBUTES,
         }
     }
 }
@@ -221,7 +287,6 @@ impl Vertex {
 #[derive(Debug, Copy, Clone, bytemuck::Pod, bytemuck::Zeroable)]
 pub struct Uniforms {
     view_proj: [[f32; 4]; 4],
-    _padding: [f32; 48],
 }
 
 impl Uniforms {
@@ -229,21 +294,48 @@ impl Uniforms {
     fn new() -> Self {
         Self {
             view_proj: cgmath::Matrix4::identity().into(),
-            _padding: [0.0; 48],
         }
     }
 
-    fn from_transform(transform: cgmath::Matrix4<f32>, width: u32, height: u32) -> Self {
-        let view = transform;
-
+    /// The projection for a surface of the given size, shared by every instance of a frame.
+    fn from_size(width: u32, height: u32) -> Self {
         let proj = cgmath::ortho(0., width as f32, height as f32, 0., 0., 1.);
         Self {
-            view_proj: (OPENGL_TO_WGPU_MATRIX * proj * view).into(),
-            _padding: [0.0; 48],
+            view_proj: (OPENGL_TO_WGPU_MATRIX * proj).into(),
         }
     }
 }
 
+/// The factor by which `transform` scales areas, expressed as a length.
+fn transform_scale(transform: &cgmath::Matrix4<f32>) -> f32 {
+    (transform.x.x * transform.y.y - transform.x.y * transform.y.x)
+        .abs()
+        .sqrt()
+}
+
+/// Number of LOD levels for cached unit geometry; level `n` is accurate up to
+/// a size of `2^n` pixels.
+const LOD_LEVELS: u8 = 13;
+
+/// Pick the coarsest LOD level that is still accurate at `screen_size` pixels.
+fn lod_level(screen_size: f32) -> u8 {
+    // `as` saturates, so NaN and sizes below one pixel land on level 0.
+    (screen_size.log2().ceil().max(0.) as u8).min(LOD_LEVELS - 1)
+}
+
+/// Pick the LOD level for content drawn at `scale` pixels per unit: the smallest
+/// power of two that is at least `scale`, as an exponent.
+fn scale_lod(scale: f32) -> i8 {
+    // `as` saturates and maps NaN to 0.
+    (scale.log2().ceil() as i8).max(-16).min(16)
+}
+
+/// Tessellation tolerance, in content units, that keeps the error of LOD level
+/// `lod` within a tenth of a pixel.
+fn lod_tolerance(lod: i8) -> f32 {
+    0.1 * 2f32.powi(-(lod as i32))
+}
+
 #[rustfmt::skip]
 pub const OPENGL_TO_WGPU_MATRIX: cgmath::Matrix4<f32> = cgmath::Matrix4::new(
     1.0, 0.0, 0.0, 0.0,
@@ -294,20 +386,16 @@ impl Color {
     }
 }
 
+/// Holds the per-frame `Uniforms`; bound once per render pass.
 struct UniformBuffer {
-    #[allow(dead_code)]
     buffer: wgpu::Buffer,
     bind_group: wgpu::BindGroup,
-    mem_align: mem_align::MemAlign<Uniforms>,
+    byte_size: usize,
 }
 
 impl UniformBuffer {
-    fn new(
-        device: &wgpu::Device,
-        capacity: usize,
-        bind_group_layout: &wgpu::BindGroupLayout,
-    ) -> Self {
-        let mem_align: mem_align::MemAlign<Uniforms> = mem_align::MemAlign::new(capacity);
+    fn new(device: &wgpu::Device, bind_group_layout: &wgpu::BindGroupLayout) -> Self {
+        let mem_align: mem_align::MemAlign<Uniforms> = mem_align::MemAlign::new(1);
 
         let uniform_buffer = device.create_buffer(&wgpu::BufferDescriptor {
             label: Some("uniform buffer"),
@@ -323,7 +411,7 @@ impl UniformBuffer {
                 resource: wgpu::BindingResource::Buffer(wgpu::BufferBinding {
                     buffer: &uniform_buffer,
                     offset: 0,
-                    size: Some(wgpu::BufferSize::new(256).unwrap()),
+                    size: wgpu::BufferSize::new(std::mem::size_of::<Uniforms>() as _),
                 }),
             }],
             label: Some("Uniform Bind Group"),
@@ -332,294 +420,1275 @@ impl UniformBuffer {
         Self {
             buffer: uniform_buffer,
             bind_group: uniform_bind_group,
-            mem_align: mem_align,
+            byte_size: mem_align.byte_size(),
         }
     }
+}
+
+/// Growable vertex buffer holding the per-instance data of a frame.
+struct InstanceBuffer<T> {
+    buffer: wgpu::Buffer,
+    mem_align: mem_align::MemAlign<T>,
+}
+
+impl<T> InstanceBuffer<T> {
+    fn new(device: &wgpu::Device, capacity: usize) -> Self {
+        let mem_align: mem_align::MemAlign<T> = mem_align::MemAlign::new(capacity);
+
+        let buffer = device.create_buffer(&wgpu::BufferDescriptor {
+            label: Some("instance buffer"),
+            size: mem_align.byte_size() as wgpu::BufferAddress,
+            usage: wgpu::BufferUsages::VERTEX | wgpu::BufferUsages::COPY_DST,
+            mapped_at_creation: false,
+        });
+
+        Self { buffer, mem_align }
+    }
 
     fn capacity(&self) -> usize {
         self.mem_align.capacity()
     }
 
-    fn resize(
-        &mut self,
-        device: &wgpu::Device,
-        capacity: usize,
-        bind_group_layout: &wgpu::BindGroupLayout,
-    ) {
+    fn resize(&mut self, device: &wgpu::Device, capacity: usize) {
         if capacity <= self.capacity() {
             return;
         }
 
-        let mem_align = mem_align::MemAlign::<Uniforms>::new(capacity);
+        *self = Self::new(device, capacity.next_power_of_two());
+    }
+}
 
-        let inner = device.create_buffer(&wgpu::BufferDescriptor {
-            label: Some("uniform buffer"),
-            size: mem_align.byte_size() as wgpu::BufferAddress,
-            usage: wgpu::BufferUsages::UNIFORM | wgpu::BufferUsages::COPY_DST,
-            mapped_at_creation: false,
-        });
+/// Sets of per frame buffers, used in turn.
+const FRAMES_IN_FLIGHT: usize = 2;
 
-        let uniform_bind_group = device.create_bind_group(&wgpu::BindGroupDescriptor {
-            layout: bind_group_layout,
-            entries: &[wgpu::BindGroupEntry {
-                binding: 0,
-                resource: wgpu::BindingResource::Buffer(wgpu::BufferBinding {
-                    buffer: &inner,
-                    offset: 0,
-                    size: Some(wgpu::BufferSize::new(256).unwrap()),
-                }),
-            }],
-            label: Some("Uniform Bind Group"),
-        });
+/// The buffers a frame writes its uniforms and instances into. Consecutive
+/// frames use different sets, so recording a frame never writes or grows the
+/// buffers of the frame before it.
+struct FrameBuffers {
+    uniform_buffer: UniformBuffer,
+    instance_buffer: InstanceBuffer<Instance>,
+    glyph_instance_buffer: InstanceBuffer<atlas::GlyphInstance>,
+    shape_instance_buffer: InstanceBuffer<shape::ShapeInstance>,
+}
 
-        self.mem_align = mem_align;
-        self.buffer = inner;
-        self.bind_group = uniform_bind_group;
+impl FrameBuffers {
+    fn new(device: &wgpu::Device, uniform_bind_group_layout: &wgpu::BindGroupLayout) -> Self {
+        Self {
+            uniform_buffer: UniformBuffer::new(device, uniform_bind_group_layout),
+            instance_buffer: InstanceBuffer::new(device, 1024),
+            glyph_instance_buffer: InstanceBuffer::new(device, 1024),
+            shape_instance_buffer: InstanceBuffer::new(device, 1024),
+        }
     }
 }
 
+/// Where a frame is drawn.
+enum FrameTarget {
+    /// Drawn and resolved straight into this view.
+    View(wgpu::TextureView),
+    /// Left in the multisampled framebuffer, or the offscreen frame target
+    /// without multisampling, until [`Painter::present`].
+    Deferred,
+}
+
+/// Compose the 2D affine part of `transform` with the affine transform of an instance.
+fn compose(transform: &cgmath::Matrix4<f32>, instance: &[[f32; 2]; 3]) -> [[f32; 2]; 3] {
+    let apply = |[x, y]: [f32; 2]| {
+        [
+            transform.x.x * x + transform.y.x * y,
+            transform.x.y * x + transform.y.y * y,
+        ]
+    };
+    let [x, y, w] = *instance;
+    let w = apply(w);
+    [
+        apply(x),
+        apply(y),
+        [w[0] + transform.w.x, w[1] + transform.w.y],
+    ]
+}
+
+#[derive(Clone)]
 enum Command {
     RawGeometry {
         path: UniqueGeometry,
-        uniform_offset: wgpu::BufferAddress,
-        indices: usize,
-        vertices: usize,
-
-        #[allow(dead_code)]
-        transform: cgmath::Matrix4<f32>,
+        instance: Instance,
+    },
+    AtlasGlyph {
+        page: usize,
+        instance: atlas::GlyphInstance,
+    },
+    /// A layer texture placed with the transform of the unit quad.
+    Texture {
+        texture: Arc<composite::LayerTexture>,
+        instance: Instance,
+    },
+    /// A circle or rounded rectangle drawn by the shape pipeline.
+    Shape { instance: shape::ShapeInstance },
+    /// A path filled by the compute rasterizer, placed by the transform of the
+    /// instance. Past the run budget it is drawn as `geometry` instead.
+    RasterFill {
+        path: Path,
+        instance: Instance,
+        geometry: UniqueGeometry,
     },
 }
 
-#[derive(Hash, PartialEq, Eq, Clone, Debug)]
-enum UniqueGeometry {
-    Rectangle(
-        OrderedFloat<f32>,
-        OrderedFloat<f32>,
-        OrderedFloat<f32>,
-        OrderedFloat<f32>,
-        Color,
-    ),
-    Circle(
-        OrderedFloat<f32>,
-        OrderedFloat<f32>,
-        OrderedFloat<f32>,
-        Color,
-    ),
-    StrokedPath(Arc<Vec<PathInstruction>>, Color, StrokeOptions),
-    Path(Arc<Vec<PathInstruction>>, Color),
+/// Drawing commands recorded once with [`Painter::begin_layer`] and
+/// [`Painter::end_layer`], and replayed with [`Painter::draw_layer`].
+///
+/// Replaying skips tessellation, path hashing and glyph layout. The layer keeps
+/// what is needed to tessellate its geometry again, so it stays valid after the
+/// geometry cache evicts it or [`Painter::clear`] is called. Its atlas text is
+/// skipped once the glyph atlas is cleared or evicts a page.
+pub struct Layer {
+    commands: Vec<Command>,
+    jobs: HashMap<UniqueGeometry, tessellation::Job>,
+    /// Generation of the glyph atlas the atlas glyphs were placed in.
+    atlas_generation: u64,
 }
 
-#[derive(Debug)]
-struct GeometryBuffer {
-    vertex_buffer: wgpu::Buffer,
-    index_buffer: wgpu::Buffer,
-    indices: usize,
-    vertices: usize,
-    vertex_capacity: usize,
-    index_capacity: usize,
+/// A [`Layer`] rendered into a texture by [`Painter::render_layer`], drawn as a
+/// single quad by [`Painter::draw_cached_layer`]. Render the layer again to
+/// invalidate it.
+pub struct CachedLayer {
+    texture: Arc<composite::LayerTexture>,
+    size: (u32, u32),
 }
 
-impl GeometryBuffer {
-    fn new(device: &wgpu::Device, vertices: &[Vertex], indices: &[u16]) -> Self {
-        let vertex_buffer = device.create_buffer_init(&wgpu::util::BufferInitDescriptor {
-            label: Some("Vertex Buffer"),
-            contents: bytemuck::cast_slice(vertices),
-            usage: wgpu::BufferUsages::VERTEX | wgpu::BufferUsages::COPY_DST,
-        });
-        let index_buffer = device.create_buffer_init(&wgpu::util::BufferInitDescriptor {
-            label: Some("Index Buffer"),
-            contents: bytemuck::cast_slice(indices),
-            usage: wgpu::BufferUsages::INDEX | wgpu::BufferUsages::COPY_DST,
-        });
-
-        Self {
-            vertex_buffer,
-            index_buffer,
-            indices: indices.len(),
-            vertices: vertices.len(),
-            vertex_capacity: vertices.len(),
-            index_capacity: indices.len(),
-        }
+impl CachedLayer {
+    /// Size of the texture in pixels.
+    pub fn size(&self) -> (u32, u32) {
+        self.size
     }
+}
+
+/// A layer being recorded, and the painter state to restore when it ends.
+struct Recording {
+    /// Kept apart from the frame, so that frames can be flushed while recording.
+    commands: Vec<Command>,
+    /// Generation of the glyph atlas when recording started, as a flush may
+    /// evict pages holding glyphs placed before it.
+    atlas_generation: u64,
+    transform: cgmath::Matrix4<f32>,
+    old_transforms: Vec<cgmath::Matrix4<f32>>,
+    jobs: HashMap<UniqueGeometry, tessellation::Job>,
+}
+
+/// What drawing needs from a [`Painter`] or a [`Recorder`].
+trait Draw {
+    fn transform(&self) -> &cgmath::Matrix4<f32>;
 
-    fn write(
+    /// Make sure `uniq` can be drawn, using the job made by `job` to tessellate
+    /// it if needed. Returns false if there is nothing to draw.
+    fn geometry(
         &mut self,
-        device: &wgpu::Device,
-        queue: &wgpu::Queue,
-        vertices: &[Vertex],
-        indices: &[u16],
-    ) {
-        self.resize_vertex(device, vertices.len());
-        queue.write_buffer(&self.vertex_buffer, 0, bytemuck::cast_slice(vertices));
-        self.vertices = vertices.len();
+        uniq: &UniqueGeometry,
+        job: impl FnOnce() -> Option<tessellation::Job>,
+    ) -> bool;
 
-        self.resize_index(device, indices.len());
-        queue.write_buffer(&self.index_buffer, 0, bytemuck::cast_slice(indices));
-        self.indices = indices.len();
-    }
+    fn push(&mut self, command: Command);
 
-    fn vertex_capacity(&self) -> usize {
-        self.vertex_capacity
-    }
+    fn shape_mode(&self) -> ShapeMode;
 
-    fn index_capacity(&self) -> usize {
-        self.index_capacity
-    }
+    fn path_rasterizer(&self) -> PathRasterizer;
+}
 
-    fn resize_vertex(&mut self, device: &wgpu::Device, capacity: usize) {
-        if capacity <= self.vertex_capacity() {
-            return;
-        }
+fn draw_rectangle(target: &mut impl Draw, x: f32, y: f32, width: f32, height: f32, color: Color) {
+    // Every rectangle is an instance of the unit square, so flip negative
+    // extents into the origin to keep a consistent winding.
+    let (x, width) = if width < 0. {
+        (x + width, -width)
+    } else {
+        (x, width)
+    };
+    let (y, height) = if height < 0. {
+        (y + height, -height)
+    } else {
+        (y, height)
+    };
 
-        let inner = device.create_buffer(&wgpu::BufferDescriptor {
-            label: Some("vertex buffer"),
-            size: (capacity * std::mem::size_of::<Vertex>()) as wgpu::BufferAddress,
-            usage: wgpu::BufferUsages::VERTEX | wgpu::BufferUsages::COPY_DST,
-            mapped_at_creation: false,
-        });
+    let uniq = UniqueGeometry::UnitRectangle;
+    target.geometry(&uniq, || Some(tessellation::Job::UnitRectangle));
+
+    let instance = Instance::placed(target.transform(), x, y, width, height, color);
+    target.push(Command::RawGeometry {
+        path: uniq,
+        instance,
+    });
+}
 
-        self.vertex_capacity = capacity;
-        self.vertex_buffer = inner;
+fn draw_circle(target: &mut impl Draw, x: f32, y: f32, radius: f32, color: Color) {
+    if target.shape_mode() == ShapeMode::Analytic {
+        return draw_rounded_rectangle(target, x, y, radius, radius, radius, 0., color);
     }
 
-    fn resize_index(&mut self, device: &wgpu::Device, capacity: usize) {
-        if capacity <= self.index_capacity() {
-            return;
-        }
+    let radius = radius.abs();
+    let lod = lod_level(radius * transform_scale(target.transform()));
+    let uniq = UniqueGeometry::UnitCircle(lod);
+    // Tessellate finely enough for the largest radius of this LOD level.
+    target.geometry(&uniq, || {
+        Some(tessellation::Job::UnitCircle(lod_tolerance(lod as i8)))
+    });
+
+    let instance = Instance::placed(target.transform(), x, y, radius, radius, color);
+    target.push(Command::RawGeometry {
+        path: uniq,
+        instance,
+    });
+}
 
-        let inner = device.create_buffer(&wgpu::BufferDescriptor {
-            label: Some("index buffer"),
-            size: (capacity * 2) as wgpu::BufferAddress,
-            usage: wgpu::BufferUsages::INDEX | wgpu::BufferUsages::COPY_DST,
-            mapped_at_creation: false,
-        });
+/// Draw a rounded rectangle centered on `(x, y)` with the shape pipeline,
+/// stroked if `line_width` is positive and filled otherwise.
+fn draw_rounded_rectangle(
+    target: &mut impl Draw,
+    x: f32,
+    y: f32,
+    half_width: f32,
+    half_height: f32,
+    radius: f32,
+    line_width: f32,
+    color: Color,
+) {
+    let instance = shape::ShapeInstance::rounded_rectangle(
+        target.transform(),
+        (x, y),
+        (half_width, half_height),
+        radius,
+        line_width,
+        color,
+    );
+    target.push(Command::Shape { instance });
+}
 
-        self.index_capacity = capacity;
-        self.index_buffer = inner;
-    }
+fn draw_stroke_path(target: &mut impl Draw, path: &Path, color: Color, options: StrokeOptions) {
+    let lod = scale_lod(transform_scale(target.transform()));
+    let uniq = UniqueGeometry::StrokedPath(path.key.clone(), options, lod);
+    target.geometry(&uniq, || {
+        let tessellator_options: lyon::tessellation::StrokeOptions = options.into();
+        let tessellator_options = tessellator_options.with_tolerance(lod_tolerance(lod));
+        Some(tessellation::Job::Stroke(
+            path.path.clone(),
+            tessellator_options,
+        ))
+    });
+
+    let instance = Instance::new(target.transform(), color);
+    target.push(Command::RawGeometry {
+        path: uniq,
+        instance,
+    });
 }
 
-#[derive(PartialEq, Eq, Hash, Clone, Copy, Debug)]
-struct HashablePoint(OrderedFloat<f32>, OrderedFloat<f32>);
+/// The job tessellating a fill of `path` for a painter scale of up to `2^lod`.
+fn fill_job(path: &Path, lod: i8) -> tessellation::Job {
+    let options = FillOptions::tolerance(lod_tolerance(lod));
+    tessellation::Job::Fill(path.path.clone(), options)
+}
 
-impl HashablePoint {
-    fn new(x: f32, y: f32) -> Self {
-        Self(OrderedFloat(x), OrderedFloat(y))
+fn draw_fill_path(target: &mut impl Draw, path: &Path, color: Color) {
+    let lod = scale_lod(transform_scale(target.transform()));
+    let uniq = UniqueGeometry::Path(path.key.clone(), lod);
+    if target.path_rasterizer() == PathRasterizer::Compute {
+        let instance = Instance::new(target.transform(), color);
+        target.push(Command::RasterFill {
+            path: path.clone(),
+            instance,
+            geometry: uniq,
+        });
+        return;
     }
+
+    target.geometry(&uniq, || Some(fill_job(path, lod)));
+
+    let instance = Instance::new(target.transform(), color);
+    target.push(Command::RawGeometry {
+        path: uniq,
+        instance,
+    });
 }
 
-#[derive(PartialEq, Eq, Hash, Clone, Debug)]
-enum PathInstruction {
-    MoveTo(HashablePoint),
-    Close,
-    LineTo(HashablePoint),
-    QuadTo(HashablePoint, HashablePoint),
-    CurveTo(HashablePoint, HashablePoint, HashablePoint),
-    Circle(HashablePoint, OrderedFloat<f32>),
-    Rectangle(HashablePoint, OrderedFloat<f32>, OrderedFloat<f32>),
+/// Fill text with tessellated glyph outlines.
+fn draw_glyphs(
+    target: &mut impl Draw,
+    font: &Font,
+    text: &str,
+    x: f32,
+    y: f32,
+    size: f32,
+    color: Color,
+    wrap_limit: Option<usize>,
+) {
+    let units_per_em = font.font.as_face_ref().units_per_em().unwrap() as f32;
+    let scale = size / units_per_em;
+    let lod = lod_level(size * transform_scale(target.transform()));
+    let options = FillOptions::tolerance(units_per_em * lod_tolerance(lod as i8));
+
+    font.layout(text, wrap_limit, |glyph, offset, line| {
+        let uniq = UniqueGeometry::Glyph(font.id, glyph.0, lod);
+        let job = || Some(tessellation::Job::Fill(font.outline(glyph)?.path, options));
+        if !target.geometry(&uniq, job) {
+            return;
+        }
+
+        let instance = Instance::placed(
+            target.transform(),
+            x + offset * scale,
+            y + line * scale,
+            scale,
+            scale,
+            color,
+        );
+        target.push(Command::RawGeometry {
+            path: uniq,
+            instance,
+        });
+    });
 }
 
-#[derive(Clone)]
-pub struct Path {
-    path: lyon::path::path::Builder,
-    path_instructions: Arc<Vec<PathInstruction>>,
+/// Stroke text with tessellated glyph outlines.
+fn draw_stroked_glyphs(
+    target: &mut impl Draw,
+    font: &Font,
+    text: &str,
+    x: f32,
+    y: f32,
+    size: f32,
+    color: Color,
+    options: StrokeOptions,
+    wrap_limit: Option<usize>,
+) {
+    let units_per_em = font.font.as_face_ref().units_per_em().unwrap() as f32;
+    let scale = size / units_per_em;
+    let lod = lod_level(size * transform_scale(target.transform()));
+    let options = options.with_line_width(options.line_width.into_inner() / scale);
+    let tessellator_options: lyon::tessellation::StrokeOptions = options.into();
+    let tessellator_options =
+        tessellator_options.with_tolerance(units_per_em * lod_tolerance(lod as i8));
+
+    font.layout(text, wrap_limit, |glyph, offset, line| {
+        let uniq = UniqueGeometry::StrokedGlyph(font.id, glyph.0, lod, options);
+        let job = || {
+            let path = font.outline(glyph)?.path;
+            Some(tessellation::Job::Stroke(path, tessellator_options))
+        };
+        if !target.geometry(&uniq, job) {
+            return;
+        }
+
+        let instance = Instance::placed(
+            target.transform(),
+            x + offset * scale,
+            y + line * scale,
+            scale,
+            scale,
+            color,
+        );
+        target.push(Command::RawGeometry {
+            path: uniq,
+            instance,
+        });
+    });
 }
 
-// Builds a geometry buffer from a path
-#[derive(Clone)]
-pub struct PathBuilder {
-    path: lyon::path::path::Builder,
-    path_instructions: Vec<PathInstruction>,
+/// Count a geometry cache lookup in the counters of its kind of primitive.
+fn count_lookup(stats: &mut PainterStats, uniq: &UniqueGeometry, cached: bool) {
+    let (hits, misses) = match uniq {
+        UniqueGeometry::UnitRectangle => (&mut stats.rectangle_hits, &mut stats.rectangle_misses),
+        UniqueGeometry::UnitCircle(_) => (&mut stats.circle_hits, &mut stats.circle_misses),
+        UniqueGeometry::Path(..) | UniqueGeometry::StrokedPath(..) => {
+            (&mut stats.path_hits, &mut stats.path_misses)
+        }
+        UniqueGeometry::Glyph(..) | UniqueGeometry::StrokedGlyph(..) => {
+            (&mut stats.glyph_hits, &mut stats.glyph_misses)
+        }
+    };
+    *if cached { hits } else { misses } += 1;
+}
+
+/// Records drawing commands on another thread, to be merged into the frame of
+/// a painter with [`Painter::draw_recorder`]. Made by [`Painter::recorder`].
+///
+/// A recorder has its own transform stack and command list, starting from the
+/// painter's transform when it was made, so that it picks the level of detail
+/// the geometry is drawn at. It sees the geometry cache as it was when it was
+/// made, so that only geometry missing from it is prepared for tessellation.
+/// Merge recorders in the frame they were made in, as a flush may evict that
+/// geometry. Text is always tessellated, as the glyph atlas belongs to the
+/// painter.
+pub struct Recorder {
+    commands: Vec<Command>,
+    jobs: HashMap<UniqueGeometry, tessellation::Job>,
+    cached: Arc<HashSet<UniqueGeometry>>,
+    /// The version of the geometry store `cached` was taken at.
+    version: u64,
     transform: cgmath::Matrix4<f32>,
     old_transforms: Vec<cgmath::Matrix4<f32>>,
+    /// Only the cache lookup counters are used.
+    lookups: PainterStats,
+    /// The shape mode of the painter when the recorder was made.
+    shape_mode: ShapeMode,
+    /// The path rasterizer of the painter when the recorder was made.
+    path_rasterizer: PathRasterizer,
 }
 
-impl PathBuilder {
-    /// Create a PathBuilder
-    pub fn new() -> Self {
-        Self {
-            path: lyon::path::Path::builder(),
-            path_instructions: Vec::new(),
-            transform: cgmath::Matrix4::identity(),
-            old_transforms: Vec::new(),
-        }
+// Recorders are only useful if they can be sent to the threads filling them.
+const _: fn() = || {
+    fn assert_send<T: Send>() {}
+    assert_send::<Recorder>();
+};
+
+impl Draw for Recorder {
+    fn transform(&self) -> &cgmath::Matrix4<f32> {
+        &self.transform
     }
 
-    /// Finish the builder and return the path
-    pub fn build(self) -> Path {
-        Path {
-            path: self.path,
-            path_instructions: Arc::new(self.path_instructions),
+    fn geometry(
+        &mut self,
+        uniq: &UniqueGeometry,
+        job: impl FnOnce() -> Option<tessellation::Job>,
+    ) -> bool {
+        let cached = self.cached.contains(uniq);
+        count_lookup(&mut self.lookups, uniq, cached);
+        if cached || self.jobs.contains_key(uniq) {
+            return true;
+        }
+        match job() {
+            Some(job) => {
+                self.jobs.insert(uniq.clone(), job);
+                true
+            }
+            None => false,
         }
     }
 
-    /// Scale the path
+    fn push(&mut self, command: Command) {
+        self.commands.push(command);
+    }
+
+    fn shape_mode(&self) -> ShapeMode {
+        self.shape_mode
+    }
+
+    fn path_rasterizer(&self) -> PathRasterizer {
+        self.path_rasterizer
+    }
+}
+
+impl Recorder {
+    /// Scale the transform by the given factor.
     pub fn scale(&mut self, x: f32, y: f32) {
         self.transform = self.transform * cgmath::Matrix4::from_nonuniform_scale(x, y, 1.);
     }
 
-    /// Rotate the path
+    /// Rotate the transform by the given angle.
     pub fn rotate(&mut self, x: f32) {
         self.transform = self.transform * cgmath::Matrix4::from_angle_z(cgmath::Rad(x));
     }
 
-    /// Translate the path
+    /// Translate the transform by the given vector.
     pub fn translate(&mut self, x: f32, y: f32) {
         self.transform = self.transform * cgmath::Matrix4::from_translation(cgmath::vec3(x, y, 0.));
     }
 
-    /// Push a new transformation matrix
+    /// Push the current transform onto the stack.
     pub fn save(&mut self) {
         self.old_transforms.push(self.transform);
     }
 
-    /// Pop the last transformation matrix
+    /// Pop the current transform from the stack.
     pub fn restore(&mut self) {
         self.transform = self.old_transforms.pop().unwrap();
     }
 
-    /// Reset the transformation matrix
+    /// Reset the transform.
     pub fn reset(&mut self) {
         self.transform = cgmath::Matrix4::identity();
     }
 
-    /// Closes the path
-    pub fn close(&mut self) {
-        self.path.close();
-        self.path_instructions.push(PathInstruction::Close);
+    /// Draw a rectangle.
+    pub fn rectangle(&mut self, x: f32, y: f32, width: f32, height: f32, color: Color) {
+        draw_rectangle(self, x, y, width, height, color);
     }
 
-    /// Moves the current point to the given point
-    pub fn move_to(&mut self, x: f32, y: f32) {
-        let (x, y) = {
-            let point = cgmath::point3(x, y, 0.);
-            let point = self.transform.transform_point(point);
-            (point.x, point.y)
-        };
-        self.path.close();
-        self.path.begin(lyon::math::point(x, y));
-        self.path_instructions
-            .push(PathInstruction::MoveTo(HashablePoint::new(x, y)));
+    /// Fill a circle.
+    pub fn circle(&mut self, x: f32, y: f32, radius: f32, color: Color) {
+        draw_circle(self, x, y, radius, color);
     }
 
-    /// Adds line to path
-    pub fn line_to(&mut self, x: f32, y: f32) {
-        let (x, y) = {
-            let point = cgmath::point3(x, y, 0.);
-            let point = self.transform.transform_point(point);
-            (point.x, point.y)
-        };
-        self.path.line_to(lyon::math::point(x, y));
-        self.path_instructions
-            .push(PathInstruction::LineTo(HashablePoint::new(x, y)));
+    /// Fill a rounded rectangle with the analytic shape pipeline.
+    pub fn rounded_rectangle(
+        &mut self,
+        x: f32,
+        y: f32,
+        width: f32,
+        height: f32,
+        radius: f32,
+        color: Color,
+    ) {
+        let (half_width, half_height) = (width / 2., height / 2.);
+        draw_rounded_rectangle(
+            self,
+            x + half_width,
+            y + half_height,
+            half_width,
+            half_height,
+            radius,
+            0.,
+            color,
+        );
     }
 
-    /// Adds quadriatic bezier to path
-    pub fn quad_to(&mut self, x1: f32, y1: f32, x: f32, y: f32) {
-        let (x, y) = {
-            let point = cgmath::point3(x, y, 0.);
-            let point = self.transform.transform_point(point);
-            (point.x, point.y)
+    /// Stroke a rounded rectangle with the analytic shape pipeline.
+    pub fn stroke_rounded_rectangle(
+        &mut self,
+        x: f32,
+        y: f32,
+        width: f32,
+        height: f32,
+        radius: f32,
+        color: Color,
+        line_width: f32,
+    ) {
+        let (half_width, half_height) = (width / 2., height / 2.);
+        draw_rounded_rectangle(
+            self,
+            x + half_width,
+            y + half_height,
+            half_width,
+            half_height,
+            radius,
+            line_width,
+            color,
+        );
+    }
+
+    /// Stroke a circle with the analytic shape pipeline.
+    pub fn stroke_circle(&mut self, x: f32, y: f32, radius: f32, color: Color, line_width: f32) {
+        draw_rounded_rectangle(self, x, y, radius, radius, radius, line_width, color);
+    }
+
+    /// Stroke the given path
+    pub fn stroke_path(&mut self, path: &Path, color: Color, options: StrokeOptions) {
+        draw_stroke_path(self, path, color, options);
+    }
+
+    /// Fill the given path
+    pub fn fill_path(&mut self, path: &Path, color: Color) {
+        draw_fill_path(self, path, color);
+    }
+
+    /// Fill the given text. `wrap_limit` can be used to limit the amount of characters in a line.
+    pub fn fill_text(
+        &mut self,
+        font: &Font,
+        text: &str,
+        x: f32,
+        y: f32,
+        size: f32,
+        color: Color,
+        wrap_limit: Option<usize>,
+    ) {
+        draw_glyphs(self, font, text, x, y, size, color, wrap_limit);
+    }
+
+    /// Stroke the given text. `wrap_limit` can be used to limit the amount of characters in a line.
+    pub fn stroke_text(
+        &mut self,
+        font: &Font,
+        text: &str,
+        x: f32,
+        y: f32,
+        size: f32,
+        color: Color,
+        options: StrokeOptions,
+        wrap_limit: Option<usize>,
+    ) {
+        draw_stroked_glyphs(self, font, text, x, y, size, color, options, wrap_limit);
+    }
+}
+
+/// A run of consecutive commands drawn with a single instanced draw call.
+enum Batch<'a> {
+    /// Instances of the same cached geometry.
+    Geometry {
+        path: &'a UniqueGeometry,
+        instances: Range<u32>,
+    },
+    /// Glyph quads sampling the same atlas page.
+    Glyphs { page: usize, instances: Range<u32> },
+    /// Quads of the same layer texture.
+    Texture {
+        texture: &'a Arc<composite::LayerTexture>,
+        instances: Range<u32>,
+    },
+    /// Analytic shape quads.
+    Shapes { instances: Range<u32> },
+    /// The target of a run of compute rasterized fills, composited as a quad.
+    Raster { run: usize, instances: Range<u32> },
+}
+
+/// Add an instance of cached geometry to `batches`, extending the last batch
+/// if it draws the same geometry.
+fn push_geometry<'a>(
+    batches: &mut Vec<Batch<'a>>,
+    instance_vec: &mut Vec<Instance>,
+    path: &'a UniqueGeometry,
+    instance: &Instance,
+) {
+    let index = instance_vec.len() as u32;
+    instance_vec.push(*instance);
+    match batches.last_mut() {
+        Some(Batch::Geometry {
+            path: batch_path,
+            instances,
+        }) if *batch_path == path => instances.end = index + 1,
+        _ => batches.push(Batch::Geometry {
+            path,
+            instances: index..index + 1,
+        }),
+    }
+}
+
+/// The pipeline bound while drawing batches.
+#[derive(Clone, Copy, PartialEq, Eq)]
+enum BoundPipeline {
+    Geometry,
+    Glyphs,
+    Texture,
+    Shapes,
+}
+
+/// Where geometry missing from the cache is tessellated.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum TessellationMode {
+    /// On the calling thread, inside the draw call.
+    Immediate,
+    /// On a pool of `threads` worker threads, uploaded at the next flush.
+    Parallel {
+        threads: usize,
+        pending: PendingGeometry,
+    },
+}
+
+impl TessellationMode {
+    /// Tessellate on one worker thread per core.
+    pub fn parallel(pending: PendingGeometry) -> Self {
+        TessellationMode::Parallel {
+            threads: std::thread::available_parallelism()
+                .map(|threads| threads.get())
+                .unwrap_or(4),
+            pending,
+        }
+    }
+}
+
+impl Default for TessellationMode {
+    fn default() -> Self {
+        TessellationMode::Immediate
+    }
+}
+
+/// What a flush does with geometry that is still being tessellated.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum PendingGeometry {
+    /// Wait for the worker pool to finish it.
+    Wait,
+    /// Leave it out of this frame; it is drawn once it is ready.
+    Skip,
+}
+
+/// How text is rendered.
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub enum TextMode {
+    /// Tessellate glyph outlines.
+    Vector,
+    /// Rasterize glyphs into a texture atlas when their on-screen em size is
+    /// at most `max_size` pixels, and tessellate larger text.
+    Atlas { max_size: f32 },
+}
+
+impl Default for TextMode {
+    fn default() -> Self {
+        TextMode::Vector
+    }
+}
+
+/// How circles are rendered. Rounded rectangles and stroked circles are
+/// always analytic.
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub enum ShapeMode {
+    /// Tessellate cached unit circles.
+    Tessellated,
+    /// Draw a single quad per circle, antialiased with its signed distance in
+    /// the fragment shader, without tessellation or a geometry cache entry.
+    Analytic,
+}
+
+impl Default for ShapeMode {
+    fn default() -> Self {
+        ShapeMode::Tessellated
+    }
+}
+
+/// How filled paths are rendered. Strokes and text are always tessellated.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum PathRasterizer {
+    /// Tessellate fills into the geometry cache.
+    Tessellated,
+    /// Flatten fills every frame and bin their lines into tiles, whose coverage
+    /// a compute shader accumulates into a texture composited in their place.
+    /// Nothing is cached, so this suits many paths that change every frame.
+    ///
+    /// Consecutive fills form a run, sharing one dispatch and one texture that
+    /// covers their bounds, rounded up to powers of two. Any other command
+    /// between two fills ends the run, so fill them together where the order
+    /// allows. A frame, or a cached layer, composites at most 32 runs; fills
+    /// past that are tessellated.
+    Compute,
+}
+
+impl Default for PathRasterizer {
+    fn default() -> Self {
+        PathRasterizer::Tessellated
+    }
+}
+
+#[derive(Hash, PartialEq, Eq, Clone, Debug)]
+enum UniqueGeometry {
+    /// The unit square, placed by the instance transform.
+    UnitRectangle,
+    /// The unit circle, tessellated for on-screen radii up to `2^lod` pixels.
+    UnitCircle(u8),
+    /// A path in its own units, tessellated for a painter scale of up to `2^lod`.
+    StrokedPath(PathKey, StrokeOptions, i8),
+    Path(PathKey, i8),
+    /// A glyph of the font with the given id, in font units, tessellated for
+    /// an em size of up to `2^lod` pixels.
+    Glyph(u64, u16, u8),
+    /// Like `Glyph`, with the stroke width in font units.
+    StrokedGlyph(u64, u16, u8, StrokeOptions),
+}
+
+/// Round a capacity up to its power-of-two size class.
+fn size_class(capacity: usize) -> usize {
+    // Keep index buffers at least 4 bytes, the granularity of buffer writes.
+    capacity.max(2).next_power_of_two()
+}
+
+/// Best-fit allocator handing out ranges of `0..capacity`.
+#[derive(Debug)]
+struct RangeAllocator {
+    capacity: u32,
+    /// Free ranges, sorted by start and never adjacent.
+    free: Vec<Range<u32>>,
+}
+
+impl RangeAllocator {
+    fn new(capacity: u32) -> Self {
+        Self {
+            capacity,
+            free: vec![0..capacity],
+        }
+    }
+
+    fn allocate(&mut self, size: u32) -> Option<Range<u32>> {
+        if size == 0 {
+            return Some(0..0);
+        }
+
+        let (index, start) = self
+            .free
+            .iter()
+            .enumerate()
+            .filter(|(_, range)| range.end - range.start >= size)
+            .min_by_key(|(_, range)| range.end - range.start)
+            .map(|(index, range)| (index, range.start))?;
+
+        self.free[index].start += size;
+        if self.free[index].is_empty() {
+            self.free.remove(index);
+        }
+        Some(start..start + size)
+    }
+
+    fn free(&mut self, range: Range<u32>) {
+        if range.is_empty() {
+            return;
+        }
+
+        let index = self.free.partition_point(|free| free.start < range.start);
+        let merges_prev = index > 0 && self.free[index - 1].end == range.start;
+        let merges_next = index < self.free.len() && self.free[index].start == range.end;
+        match (merges_prev, merges_next) {
+            (true, true) => {
+                self.free[index - 1].end = self.free[index].end;
+                self.free.remove(index);
+            }
+            (true, false) => self.free[index - 1].end = range.end,
+            (false, true) => self.free[index].start = range.start,
+            (false, false) => self.free.insert(index, range),
+        }
+    }
+
+    /// Mark everything below `used` as allocated and the rest as free.
+    fn reset_packed(&mut self, used: u32) {
+        self.free.clear();
+        if used < self.capacity {
+            self.free.push(used..self.capacity);
+        }
+    }
+
+    fn free_size(&self) -> u32 {
+        self.free.iter().map(|range| range.end - range.start).sum()
+    }
+
+    fn largest_free(&self) -> u32 {
+        self.free
+            .iter()
+            .map(|range| range.end - range.start)
+            .max()
+            .unwrap_or(0)
+    }
+
+    fn is_empty(&self) -> bool {
+        self.free_size() == self.capacity
+    }
+}
+
+/// A large vertex and index buffer pair that cached geometry is suballocated from.
+#[derive(Debug)]
+struct GeometryArena {
+    vertex_buffer: wgpu::Buffer,
+    index_buffer: wgpu::Buffer,
+    vertices: RangeAllocator,
+    indices: RangeAllocator,
+}
+
+impl GeometryArena {
+    const VERTEX_CAPACITY: usize = 1 << 18;
+    const INDEX_CAPACITY: usize = 1 << 19;
+
+    fn new(device: &wgpu::Device, vertex_capacity: usize, index_capacity: usize) -> Self {
+        Self {
+            vertex_buffer: Self::create_vertex_buffer(device, vertex_capacity),
+            index_buffer: Self::create_index_buffer(device, index_capacity),
+            vertices: RangeAllocator::new(vertex_capacity as u32),
+            indices: RangeAllocator::new(index_capacity as u32),
+        }
+    }
+
+    fn create_vertex_buffer(device: &wgpu::Device, capacity: usize) -> wgpu::Buffer {
+        device.create_buffer(&wgpu::BufferDescriptor {
+            label: Some("vertex arena"),
+            size: (capacity * std::mem::size_of::<Vertex>()) as wgpu::BufferAddress,
+            usage: wgpu::BufferUsages::VERTEX
+                | wgpu::BufferUsages::COPY_DST
+                | wgpu::BufferUsages::COPY_SRC,
+            mapped_at_creation: false,
+        })
+    }
+
+    fn create_index_buffer(device: &wgpu::Device, capacity: usize) -> wgpu::Buffer {
+        device.create_buffer(&wgpu::BufferDescriptor {
+            label: Some("index arena"),
+            size: (capacity * std::mem::size_of::<u16>()) as wgpu::BufferAddress,
+            usage: wgpu::BufferUsages::INDEX
+                | wgpu::BufferUsages::COPY_DST
+                | wgpu::BufferUsages::COPY_SRC,
+            mapped_at_creation: false,
+        })
+    }
+
+    fn allocate(&mut self, vertices: u32, indices: u32) -> Option<(Range<u32>, Range<u32>)> {
+        let vertex_range = self.vertices.allocate(vertices)?;
+        match self.indices.allocate(indices) {
+            Some(index_range) => Some((vertex_range, index_range)),
+            None => {
+                self.vertices.free(vertex_range);
+                None
+            }
+        }
+    }
+
+    fn fits(&self, vertices: u32, indices: u32) -> bool {
+        self.vertices.free_size() >= vertices && self.indices.free_size() >= indices
+    }
+
+    /// Whether most of the free space is split into ranges too small to be useful.
+    fn is_fragmented(&self) -> bool {
+        let fragmented = |allocator: &RangeAllocator| {
+            let free = allocator.free_size();
+            free >= allocator.capacity / 4 && allocator.largest_free() < free / 2
+        };
+        fragmented(&self.vertices) || fragmented(&self.indices)
+    }
+
+    fn is_empty(&self) -> bool {
+        self.vertices.is_empty() && self.indices.is_empty()
+    }
+
+    /// GPU memory held by both buffers, in bytes.
+    fn byte_size(&self) -> usize {
+        self.vertices.capacity as usize * std::mem::size_of::<Vertex>()
+            + self.indices.capacity as usize * std::mem::size_of::<u16>()
+    }
+}
+
+/// Where a cached geometry lives inside the arenas.
+#[derive(Clone, Debug)]
+struct GeometryAllocation {
+    arena: usize,
+    vertices: Range<u32>,
+    /// Index data in 16 bit slots; a 32 bit index takes two of them.
+    indices: Range<u32>,
+    /// Whether the indices are 32 bit.
+    wide: bool,
+}
+
+impl GeometryAllocation {
+    fn index_format(&self) -> wgpu::IndexFormat {
+        if self.wide {
+            wgpu::IndexFormat::Uint32
+        } else {
+            wgpu::IndexFormat::Uint16
+        }
+    }
+
+    /// The indices to draw, counted in the index format.
+    fn index_range(&self) -> Range<u32> {
+        if self.wide {
+            // Slot ranges always start at an even slot, see `Tessellator::tessellate`.
+            self.indices.start / 2..self.indices.end / 2
+        } else {
+            self.indices.clone()
+        }
+    }
+
+    fn byte_size(&self) -> usize {
+        self.vertices.len() * std::mem::size_of::<Vertex>()
+            + self.indices.len() * std::mem::size_of::<u16>()
+    }
+}
+
+#[derive(Debug)]
+struct CachedGeometry {
+    allocation: GeometryAllocation,
+    /// Bounding box of the vertices, in geometry space.
+    bounds: Bounds,
+    last_used: u64,
+}
+
+/// Axis aligned bounding box.
+#[derive(Clone, Copy, Debug, PartialEq)]
+struct Bounds {
+    min: [f32; 2],
+    max: [f32; 2],
+}
+
+impl Bounds {
+    /// The whole of a target of `size` pixels.
+    fn of_size(size: (u32, u32)) -> Self {
+        Bounds {
+            min: [0., 0.],
+            max: [size.0 as f32, size.1 as f32],
+        }
+    }
+
+    /// The bounds of the unit quad that glyph instances are placed from.
+    const UNIT: Bounds = Bounds {
+        min: [0., 0.],
+        max: [1., 1.],
+    };
+
+    /// Bounds of `vertices`, empty if there are none.
+    fn of(vertices: &[Vertex]) -> Self {
+        vertices.iter().fold(
+            Bounds {
+                min: [f32::INFINITY; 2],
+                max: [f32::NEG_INFINITY; 2],
+            },
+            |bounds, vertex| Bounds {
+                min: [
+                    bounds.min[0].min(vertex.position[0]),
+                    bounds.min[1].min(vertex.position[1]),
+                ],
+                max: [
+                    bounds.max[0].max(vertex.position[0]),
+                    bounds.max[1].max(vertex.position[1]),
+                ],
+            },
+        )
+    }
+
+    /// Bounds of the points of `path`, which contain its curves.
+    fn of_path(path: &lyon::path::Path) -> Self {
+        use lyon::path::PathEvent;
+
+        let mut bounds = Bounds {
+            min: [f32::INFINITY; 2],
+            max: [f32::NEG_INFINITY; 2],
+        };
+        let mut add = |point: lyon::math::Point| {
+            bounds.min = [bounds.min[0].min(point.x), bounds.min[1].min(point.y)];
+            bounds.max = [bounds.max[0].max(point.x), bounds.max[1].max(point.y)];
+        };
+        for event in path.iter() {
+            match event {
+                PathEvent::Begin { at } => add(at),
+                PathEvent::Line { to, .. } => add(to),
+                PathEvent::Quadratic { ctrl, to, .. } => {
+                    add(ctrl);
+                    add(to);
+                }
+                PathEvent::Cubic {
+                    ctrl1, ctrl2, to, ..
+                } => {
+                    add(ctrl1);
+                    add(ctrl2);
+                    add(to);
+                }
+                PathEvent::End { .. } => {}
+            }
+        }
+        bounds
+    }
+
+    /// Bounds of this box after the affine transform of an instance.
+    fn transformed(&self, transform: &[[f32; 2]; 3]) -> Self {
+        let [x, y, w] = transform;
+        // Each output coordinate is extreme at one of the corners, chosen per
+        // matrix entry by its sign.
+        let mut min = *w;
+        let mut max = *w;
+        for axis in 0..2 {
+            for (column, range) in [(x, 0), (y, 1)] {
+                let a = column[axis] * self.min[range];
+                let b = column[axis] * self.max[range];
+                min[axis] += a.min(b);
+                max[axis] += a.max(b);
+            }
+        }
+        Bounds { min, max }
+    }
+
+    fn union(&self, other: &Bounds) -> Self {
+        Bounds {
+            min: [self.min[0].min(other.min[0]), self.min[1].min(other.min[1])],
+            max: [self.max[0].max(other.max[0]), self.max[1].max(other.max[1])],
+        }
+    }
+
+    fn intersects(&self, other: &Bounds) -> bool {
+        self.min[0] <= other.max[0]
+            && other.min[0] <= self.max[0]
+            && self.min[1] <= other.max[1]
+            && other.min[1] <= self.max[1]
+    }
+}
+
+/// What a command drew last frame: a hash of everything that affects its
+/// pixels, and where they are.
+#[derive(Clone, Copy, PartialEq)]
+struct DrawnCommand {
+    hash: u64,
+    bounds: Bounds,
+}
+
+/// The part of the target that differs between two frames, or `None` if they
+/// draw the same. Commands are compared in order, so that changes in stacking
+/// are damage as well.
+fn damage(previous: &[DrawnCommand], current: &[DrawnCommand]) -> Option<Bounds> {
+    let common = previous.len().min(current.len());
+    let changed = previous
+        .iter()
+        .zip(current.iter())
+        .filter(|(previous, current)| previous.hash != current.hash)
+        .flat_map(|(previous, current)| [previous.bounds, current.bounds]);
+    let added_or_removed = previous[common..].iter().chain(current[common..].iter());
+    changed
+        .chain(added_or_removed.map(|command| command.bounds))
+        .reduce(|damage, bounds| damage.union(&bounds))
+}
+
+#[derive(PartialEq, Eq, Hash, Clone, Copy, Debug)]
+struct HashablePoint(OrderedFloat<f32>, OrderedFloat<f32>);
+
+impl HashablePoint {
+    fn new(x: f32, y: f32) -> Self {
+        Self(OrderedFloat(x), OrderedFloat(y))
+    }
+}
+
+#[derive(PartialEq, Eq, Hash, Clone, Debug)]
+enum PathInstruction {
+    MoveTo(HashablePoint),
+    Close,
+    LineTo(HashablePoint),
+    QuadTo(HashablePoint, HashablePoint),
+    CurveTo(HashablePoint, HashablePoint, HashablePoint),
+    Circle(HashablePoint, OrderedFloat<f32>),
+    Rectangle(HashablePoint, OrderedFloat<f32>, OrderedFloat<f32>),
+}
+
+/// A content hash of a built [`Path`].
+///
+/// Paths built from the same instructions share an id, so it can be used to
+/// recognize a path across frames without comparing its instructions.
+#[derive(PartialEq, Eq, Hash, Clone, Copy, Debug)]
+pub struct PathId(pub u64);
+
+/// Geometry cache key for a path, hashed by its precomputed [`PathId`].
+///
+/// Keys are compared by the id and a second, independently salted hash of
+/// the instructions, so a cache lookup never walks them. A false match needs
+/// both 64 bit hashes to collide.
+#[derive(Clone, Debug)]
+struct PathKey {
+    id: PathId,
+    check: u64,
+}
+
+impl std::hash::Hash for PathKey {
+    fn hash<H: std::hash::Hasher>(&self, state: &mut H) {
+        self.id.hash(state);
+    }
+}
+
+impl PartialEq for PathKey {
+    fn eq(&self, other: &Self) -> bool {
+        self.id == other.id && self.check == other.check
+    }
+}
+
+impl Eq for PathKey {}
+
+/// Salt of the second hash of a [`PathKey`].
+const PATH_CHECK_SALT: u64 = 0x9e37_79b9_7f4a_7c15;
+
+#[derive(Clone)]
+pub struct Path {
+    path: Arc<lyon::path::Path>,
+    key: PathKey,
+    /// Bounds of the path in its own units, for culling compute rasterized fills.
+    bounds: Bounds,
+}
+
+impl Path {
+    /// The content hash of this path
+    pub fn id(&self) -> PathId {
+        self.key.id
+    }
+}
+
+// Builds a geometry buffer from a path
+#[derive(Clone)]
+pub struct PathBuilder {
+    path: lyon::path::path::Builder,
+    path_instructions: Vec<PathInstruction>,
+    transform: cgmath::Matrix4<f32>,
+    old_transforms: Vec<cgmath::Matrix4<f32>>,
+}
+
+impl PathBuilder {
+    /// Create a PathBuilder
+    pub fn new() -> Self {
+        Self {
+            path: lyon::path::Path::builder(),
+            path_instructions: Vec::new(),
+            transform: cgmath::Matrix4::identity(),
+            old_transforms: Vec::new(),
+        }
+    }
+
+    /// Finish the builder and return the path
+    pub fn build(self) -> Path {
+        use std::hash::{Hash, Hasher};
+
+        let mut hasher = std::collections::hash_map::DefaultHasher::new();
+        self.path_instructions.hash(&mut hasher);
+        let mut check = std::collections::hash_map::DefaultHasher::new();
+        PATH_CHECK_SALT.hash(&mut check);
+        self.path_instructions.hash(&mut check);
+
+        let path = self.path.build();
+        Path {
+            bounds: Bounds::of_path(&path),
+            path: Arc::new(path),
+            key: PathKey {
+                id: PathId(hasher.finish()),
+                check: check.finish(),
+            },
+        }
+    }
+
+    /// Scale the path
+    pub fn scale(&mut self, x: f32, y: f32) {
+        self.transform = self.transform * cgmath::Matrix4::from_nonuniform_scale(x, y, 1.);
+    }
+
+    /// Rotate the path
+    pub fn rotate(&mut self, x: f32) {
+        self.transform = self.transform * cgmath::Matrix4::from_angle_z(cgmath::Rad(x));
+    }
+
+    /// Translate the path
+    pub fn translate(&mut self, x: f32, y: f32) {
+        self.transform = self.transform * cgmath::Matrix4::from_translation(cgmath::vec3(x, y, 0.));
+    }
+
+    /// Push a new transformation matrix
+    pub fn save(&mut self) {
+        self.old_transforms.push(self.transform);
+    }
+
+    /// Pop the last transformation matrix
+    pub fn restore(&mut self) {
+        self.transform = self.old_transforms.pop().unwrap();
+    }
+
+    /// Reset the transformation matrix
+    pub fn reset(&mut self) {
+        self.transform = cgmath::Matrix4::identity();
+    }
+
+    /// Closes the path
+    pub fn close(&mut self) {
+        self.path.close();
+        self.path_instructions.push(PathInstruction::Close);
+    }
+
+    /// Moves the current point to the given point
+    pub fn move_to(&mut self, x: f32, y: f32) {
+        let (x, y) = {
+            let point = cgmath::point3(x, y, 0.);
+            let point = self.transform.transform_point(point);
+            (point.x, point.y)
+        };
+        self.path.close();
+        self.path.begin(lyon::math::point(x, y));
+        self.path_instructions
+            .push(PathInstruction::MoveTo(HashablePoint::new(x, y)));
+    }
+
+    /// Adds line to path
+    pub fn line_to(&mut self, x: f32, y: f32) {
+        let (x, y) = {
+            let point = cgmath::point3(x, y, 0.);
+            let point = self.transform.transform_point(point);
+            (point.x, point.y)
+        };
+        self.path.line_to(lyon::math::point(x, y));
+        self.path_instructions
+            .push(PathInstruction::LineTo(HashablePoint::new(x, y)));
+    }
+
+    /// Adds quadriatic bezier to path
+    pub fn quad_to(&mut self, x1: f32, y1: f32, x: f32, y: f32) {
+        let (x, y) = {
+            let point = cgmath::point3(x, y, 0.);
+            let point = self.transform.transform_point(point);
+            (point.x, point.y)
         };
         let (x1, y1) = {
             let point = cgmath::point3(x1, y1, 0.);
@@ -726,19 +1795,72 @@ impl PathBuilder {
             HashablePoint::new(x, y),
         ));
     }
-}
+}
+
+/// A ttf/otf font
+pub struct Font {
+    font: owned_ttf_parser::OwnedFace,
+    /// Identifies the glyphs of this font in the geometry cache.
+    id: u64,
+}
+
+impl Font {
+    /// Load a font from the given data
+    pub fn new(font: &[u8]) -> Option<Self> {
+        use std::sync::atomic::{AtomicU64, Ordering};
+        static NEXT_ID: AtomicU64 = AtomicU64::new(0);
+
+        let owned_face = owned_ttf_parser::OwnedFace::from_vec(font.to_vec(), 0).ok()?;
+
+        Some(Self {
+            font: owned_face,
+            id: NEXT_ID.fetch_add(1, Ordering::Relaxed),
+        })
+    }
+
+    /// Lay out `text`, calling `place` with each glyph and its pen position in font units.
+    fn layout(
+        &self,
+        text: &str,
+        wrap_limit: Option<usize>,
+        mut place: impl FnMut(owned_ttf_parser::GlyphId, f32, f32),
+    ) {
+        match wrap_limit {
+            Some(limit) => assert_ne!(limit, 0),
+            None => (),
+        }
+        let face = self.font.as_face_ref();
+        let bbox = face.global_bounding_box();
+        let line_height = (bbox.y_min + bbox.y_max) as f32;
+        let line_height = line_height * 1.2;
+        let glyph_width = (bbox.x_min + bbox.x_max) as f32;
+        let (mut offset, mut line) = (0., line_height);
+        for character in text.chars() {
+            if character == '\n' {
+                offset = 0.;
+                line += line_height;
+                continue;
+            }
+            let glyph = face.glyph_index(character).unwrap();
+            place(glyph, offset, line);
+            offset += face.glyph_hor_advance(glyph).unwrap() as f32;
+            match wrap_limit {
+                Some(limit) => {
+                    if offset > glyph_width * limit as f32 && character == ' ' {
+                        offset = 0.;
+                        line += line_height;
+                    }
+                }
+                None => (),
+            }
+        }
+    }
 
-/// A ttf/otf font
-pub struct Font {
-    font: owned_ttf_parser::OwnedFace,
-}
-
-impl Font {
-    /// Load a font from the given data
-    pub fn new(font: &[u8]) -> Option<Self> {
-        let owned_face = owned_ttf_parser::OwnedFace::from_vec(font.to_vec(), 0).ok()?;
-
-        Some(Self { font: owned_face })
+    /// Outline a glyph into a path in font units, or `None` if it has no outline.
+    fn outline(&self, glyph: owned_ttf_parser::GlyphId) -> Option<Path> {
+        let mut path = PathBuilder::new();
+        self.font.as_face_ref().outline_glyph(glyph, &mut path)?;
+        Some(path.build())
     }
 }
 
@@ -762,18 +1884,182 @@ impl owned_ttf_parser::OutlineBuilder for PathBuilder {
     }
 }
 
+/// Controls how long geometry stays cached after it was last drawn.
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub struct RetentionPolicy {
+    /// Number of flushes a geometry may go undrawn before it is evicted.
+    pub max_age: u64,
+    /// Upper bound on GPU memory held by geometry arenas, in bytes.
+    /// Least recently drawn geometry is evicted first when it is exceeded.
+    pub max_bytes: Option<usize>,
+    /// Upper bound on free arena space kept for reuse, in bytes.
+    /// Arenas that hold no geometry are released when it is exceeded.
+    pub max_pooled_bytes: Option<usize>,
+    /// Upper bound on glyph atlas pages, in bytes. Least recently used pages
+    /// are evicted at the end of a frame when it is exceeded, keeping the ones
+    /// the frame used.
+    pub max_atlas_bytes: Option<usize>,
+}
+
+impl RetentionPolicy {
+    /// Evict geometry as soon as it goes undrawn for one frame.
+    pub const IMMEDIATE: Self = Self {
+        max_age: 0,
+        max_bytes: None,
+        max_pooled_bytes: None,
+        max_atlas_bytes: Some(0),
+    };
+}
+
+impl Default for RetentionPolicy {
+    fn default() -> Self {
+        Self {
+            max_age: 120,
+            max_bytes: Some(64 * 1024 * 1024),
+            max_pooled_bytes: Some(8 * 1024 * 1024),
+            max_atlas_bytes: Some(16 * 1024 * 1024),
+        }
+    }
+}
+
+/// Counters describing the geometry cache, useful to tune a [`RetentionPolicy`].
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct GeometryCacheStats {
+    /// Draws that found their geometry already cached.
+    pub hits: u64,
+    /// Draws that had to tessellate and upload their geometry.
+    pub misses: u64,
+    /// Cached geometries evicted by the retention policy.
+    pub evictions: u64,
+    /// Number of geometries currently cached.
+    pub resident: usize,
+    /// Bytes of arena space holding cached geometry.
+    pub resident_bytes: usize,
+    /// Bytes of arena space free for new geometry.
+    pub pooled_bytes: usize,
+    /// Bytes of geometry uploaded into the arenas.
+    pub uploaded_bytes: u64,
+}
+
+/// Counters of a painter, for scraping into metrics every frame.
+///
+/// Cache lookups and uploaded bytes add up over the lifetime of the painter,
+/// the per frame counters describe the last flushed frame, and the remaining
+/// ones the current GPU memory use.
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+#[repr(C)]
+pub struct PainterStats {
+    /// Rectangles that found their unit geometry cached.
+    pub rectangle_hits: u64,
+    pub rectangle_misses: u64,
+    /// Circles that found their unit geometry of the right LOD cached.
+    pub circle_hits: u64,
+    pub circle_misses: u64,
+    /// Filled and stroked paths.
+    pub path_hits: u64,
+    pub path_misses: u64,
+    /// Filled and stroked glyph outlines.
+    pub glyph_hits: u64,
+    pub glyph_misses: u64,
+    /// Glyphs found in the glyph atlas, or rasterized into it.
+    pub atlas_glyph_hits: u64,
+    pub atlas_glyph_misses: u64,
+    /// Cached geometries evicted by the retention policy.
+    pub evictions: u64,
+    /// Bytes written to GPU buffers and textures.
+    pub uploaded_bytes: u64,
+
+    /// Vertices tessellated during the last frame.
+    pub tessellated_vertices: u64,
+    /// Indices tessellated during the last frame.
+    pub tessellated_indices: u64,
+    /// Draw calls of the last frame, including rendered layers.
+    pub draw_calls: u64,
+    /// Instances drawn by the last frame, including rendered layers.
+    pub instances: u64,
+
+    /// Number of geometries currently cached.
+    pub resident_geometries: u64,
+    /// Bytes of arena space holding cached geometry.
+    pub geometry_resident_bytes: u64,
+    /// Bytes of arena space free for new geometry.
+    pub geometry_pooled_bytes: u64,
+    /// Bytes of the instance buffers.
+    pub instance_buffer_bytes: u64,
+    /// Bytes of the uniform buffer.
+    pub uniform_buffer_bytes: u64,
+    /// Texture pages of the glyph atlas.
+    pub atlas_pages: u64,
+    /// Glyph atlas pages evicted by the retention policy.
+    pub atlas_evictions: u64,
+}
+
+impl PainterStats {
+    /// Add the geometry cache lookups counted by a [`Recorder`].
+    fn add_lookups(&mut self, lookups: &PainterStats) {
+        self.rectangle_hits += lookups.rectangle_hits;
+        self.rectangle_misses += lookups.rectangle_misses;
+        self.circle_hits += lookups.circle_hits;
+        self.circle_misses += lookups.circle_misses;
+        self.path_hits += lookups.path_hits;
+        self.path_misses += lookups.path_misses;
+        self.glyph_hits += lookups.glyph_hits;
+        self.glyph_misses += lookups.glyph_misses;
+    }
+}
+
+/// Counters of the frame being drawn, published to [`PainterStats`] when it ends.
+#[derive(Debug, Default)]
+struct FrameStats {
+    tessellated_vertices: u64,
+    tessellated_indices: u64,
+    draw_calls: u64,
+    instances: u64,
+}
+
+impl FrameStats {
+    fn count_geometry(&mut self, geometry: &tessellation::GeometryRef) {
+        self.tessellated_vertices += geometry.vertices.len() as u64;
+        self.tessellated_indices += geometry.indices.len() as u64;
+    }
+}
+
 #[derive(Debug)]
 struct GeometryStore {
-    in_use: HashMap<UniqueGeometry, GeometryBuffer>,
-    free: Vec<GeometryBuffer>,
+    in_use: HashMap<UniqueGeometry, CachedGeometry>,
+    arenas: Vec<Option<GeometryArena>>,
+    policy: RetentionPolicy,
+    stats: GeometryCacheStats,
+    frame: u64,
+    /// Bumped whenever the set of cached geometry changes.
+    version: u64,
 }
 
 impl GeometryStore {
-    fn new() -> Self {
+    fn new(policy: RetentionPolicy) -> Self {
         Self {
             in_use: HashMap::new(),
-            free: Vec::new(),
+            arenas: Vec::new(),
+            policy,
+            stats: GeometryCacheStats::default(),
+            frame: 0,
+            version: 0,
+        }
+    }
+
+    /// Check whether `uniq` is cached, counting the lookup as a hit or a miss.
+    fn contains(&mut self, uniq: &UniqueGeometry) -> bool {
+        let found = self.in_use.contains_key(uniq);
+        if found {
+            self.stats.hits += 1;
+        } else {
+            self.stats.misses += 1;
         }
+        found
+    }
+
+    fn arena(&self, index: usize) -> &GeometryArena {
+        self.arenas[index].as_ref().unwrap()
     }
 
     fn malloc(
@@ -781,41 +2067,285 @@ impl GeometryStore {
         device: &wgpu::Device,
         queue: &wgpu::Queue,
         uniq: UniqueGeometry,
-        vertices: &[Vertex],
-        indices: &[u16],
+        geometry: tessellation::GeometryRef,
     ) {
-        match self.free.pop() {
-            Some(mut buffer) => {
-                buffer.write(device, queue, vertices, indices);
-                self.in_use.insert(uniq, buffer);
+        let vertices = geometry.vertices;
+        let indices = geometry.indices.as_bytes();
+        let slots = indices.len() / std::mem::size_of::<u16>();
+        let mut allocation = self.allocate(device, queue, vertices.len(), slots);
+        allocation.wide = matches!(geometry.indices, tessellation::Indices::U32(_));
+
+        let arena = self.arena(allocation.arena);
+        if !vertices.is_empty() {
+            queue.write_buffer(
+                &arena.vertex_buffer,
+                (allocation.vertices.start as usize * std::mem::size_of::<Vertex>()) as _,
+                bytemuck::cast_slice(vertices),
+            );
+        }
+        if !indices.is_empty() {
+            queue.write_buffer(
+                &arena.index_buffer,
+                (allocation.indices.start as usize * std::mem::size_of::<u16>()) as _,
+                indices,
+            );
+        }
+
+        self.stats.uploaded_bytes += (std::mem::size_of_val(vertices) + indices.len()) as u64;
+        self.stats.resident += 1;
+        self.stats.resident_bytes += allocation.byte_size();
+        self.stats.pooled_bytes -= allocation.byte_size();
+        self.version += 1;
+        self.in_use.insert(
+            uniq,
+            CachedGeometry {
+                allocation,
+                bounds: Bounds::of(vertices),
+                last_used: self.frame,
+            },
+        );
+    }
+
+    fn allocate(
+        &mut self,
+        device: &wgpu::Device,
+        queue: &wgpu::Queue,
+        vertices: usize,
+        indices: usize,
+    ) -> GeometryAllocation {
+        let (vertex_count, index_count) = (vertices as u32, indices as u32);
+        let allocate_in = |arenas: &mut Vec<Option<GeometryArena>>, arena: usize| {
+            let (vertices, indices) = arenas[arena]
+                .as_mut()?
+                .allocate(vertex_count, index_count)?;
+            Some(GeometryAllocation {
+                arena,
+                vertices,
+                indices,
+                wide: false,
+            })
+        };
+
+        for arena in 0..self.arenas.len() {
+            if let Some(allocation) = allocate_in(&mut self.arenas, arena) {
+                return allocation;
+            }
+        }
+
+        // An arena with enough free space in total only needs compacting.
+        let fragmented = self.arenas.iter().position(|arena| {
+            arena
+                .as_ref()
+                .map_or(false, |arena| arena.fits(vertex_count, index_count))
+        });
+        if let Some(arena) = fragmented {
+            self.compact(device, queue, arena);
+            if let Some(allocation) = allocate_in(&mut self.arenas, arena) {
+                return allocation;
+            }
+        }
+
+        let arena = GeometryArena::new(
+            device,
+            size_class(vertices).max(GeometryArena::VERTEX_CAPACITY),
+            size_class(indices).max(GeometryArena::INDEX_CAPACITY),
+        );
+        self.stats.pooled_bytes += arena.byte_size();
+        let index = match self.arenas.iter().position(Option::is_none) {
+            Some(index) => {
+                self.arenas[index] = Some(arena);
+                index
             }
             None => {
-                let buffer = GeometryBuffer::new(&device, vertices, indices);
-                self.in_use.insert(uniq, buffer);
+                self.arenas.push(Some(arena));
+                self.arenas.len() - 1
+            }
+        };
+        allocate_in(&mut self.arenas, index).unwrap()
+    }
+
+    /// Move every geometry of an arena to the front of fresh buffers, merging its free space.
+    fn compact(&mut self, device: &wgpu::Device, queue: &wgpu::Queue, index: usize) {
+        let arena = self.arenas[index].as_mut().unwrap();
+        let vertex_buffer =
+            GeometryArena::create_vertex_buffer(device, arena.vertices.capacity as usize);
+        let index_buffer =
+            GeometryArena::create_index_buffer(device, arena.indices.capacity as usize);
+        let mut encoder = device.create_command_encoder(&wgpu::CommandEncoderDescriptor {
+            label: Some("Compact Geometry Arena"),
+        });
+
+        let vertex_size = std::mem::size_of::<Vertex>() as wgpu::BufferAddress;
+        let index_size = std::mem::size_of::<u16>() as wgpu::BufferAddress;
+        let (mut vertex_end, mut index_end) = (0, 0);
+        for geometry in self.in_use.values_mut() {
+            let allocation = &mut geometry.allocation;
+            if allocation.arena != index {
+                continue;
+            }
+
+            let vertices = allocation.vertices.end - allocation.vertices.start;
+            if vertices > 0 {
+                encoder.copy_buffer_to_buffer(
+                    &arena.vertex_buffer,
+                    allocation.vertices.start as wgpu::BufferAddress * vertex_size,
+                    &vertex_buffer,
+                    vertex_end as wgpu::BufferAddress * vertex_size,
+                    vertices as wgpu::BufferAddress * vertex_size,
+                );
+            }
+            allocation.vertices = vertex_end..vertex_end + vertices;
+            vertex_end += vertices;
+
+            let indices = allocation.indices.end - allocation.indices.start;
+            if indices > 0 {
+                encoder.copy_buffer_to_buffer(
+                    &arena.index_buffer,
+                    allocation.indices.start as wgpu::BufferAddress * index_size,
+                    &index_buffer,
+                    index_end as wgpu::BufferAddress * index_size,
+                    indices as wgpu::BufferAddress * index_size,
+                );
             }
+            allocation.indices = index_end..index_end + indices;
+            index_end += indices;
+        }
+
+        queue.submit(iter::once(encoder.finish()));
+        arena.vertex_buffer = vertex_buffer;
+        arena.index_buffer = index_buffer;
+        arena.vertices.reset_packed(vertex_end);
+        arena.indices.reset_packed(index_end);
+    }
+
+    /// Mark `uniq` as drawn this frame.
+    fn touch(&mut self, uniq: &UniqueGeometry) {
+        if let Some(geometry) = self.in_use.get_mut(uniq) {
+            geometry.last_used = self.frame;
         }
     }
 
     fn free(&mut self, uniq: &UniqueGeometry) {
-        self.free.push(self.in_use.remove(uniq).unwrap());
+        let allocation = self.in_use.remove(uniq).unwrap().allocation;
+        self.version += 1;
+        let arena = self.arenas[allocation.arena].as_mut().unwrap();
+        arena.vertices.free(allocation.vertices.clone());
+        arena.indices.free(allocation.indices.clone());
+
+        self.stats.resident -= 1;
+        self.stats.resident_bytes -= allocation.byte_size();
+        self.stats.pooled_bytes += allocation.byte_size();
+    }
+
+    /// Release arenas holding no geometry for as long as `over_budget` holds.
+    fn release_empty_arenas(&mut self, over_budget: impl Fn(&GeometryCacheStats) -> bool) {
+        for slot in self.arenas.iter_mut() {
+            if !over_budget(&self.stats) {
+                break;
+            }
+            if slot.as_ref().map_or(false, GeometryArena::is_empty) {
+                self.stats.pooled_bytes -= slot.take().unwrap().byte_size();
+            }
+        }
     }
 
-    fn free_unused(&mut self, used: &HashSet<&UniqueGeometry>) {
+    /// Evict geometry according to the retention policy, defragment the
+    /// arenas and advance to the next frame.
+    fn end_frame(&mut self, device: &wgpu::Device, queue: &wgpu::Queue) {
+        let frame = self.frame;
+        let max_age = self.policy.max_age;
         let mut to_remove = Vec::new();
-        for (uniq, _) in self.in_use.iter() {
-            if !used.contains(uniq) {
+        for (uniq, geometry) in self.in_use.iter() {
+            if frame - geometry.last_used > max_age {
                 to_remove.push(uniq.clone());
             }
         }
+        self.stats.evictions += to_remove.len() as u64;
         for uniq in to_remove {
             self.free(&uniq);
         }
+
+        if let Some(max_bytes) = self.policy.max_bytes {
+            // Release unused arenas before evicting anything still cached.
+            self.release_empty_arenas(|stats| {
+                stats.resident_bytes + stats.pooled_bytes > max_bytes
+            });
+
+            if self.stats.resident_bytes > max_bytes {
+                // Geometry drawn this frame is never evicted, it would only be
+                // tessellated again on the next one.
+                let mut candidates: Vec<(u64, UniqueGeometry)> = self
+                    .in_use
+                    .iter()
+                    .filter(|(_, geometry)| geometry.last_used < frame)
+                    .map(|(uniq, geometry)| (geometry.last_used, uniq.clone()))
+                    .collect();
+                candidates.sort_unstable_by_key(|(last_used, _)| *last_used);
+
+                for (_, uniq) in candidates {
+                    if self.stats.resident_bytes <= max_bytes {
+                        break;
+                    }
+                    self.free(&uniq);
+                    self.stats.evictions += 1;
+                }
+                self.release_empty_arenas(|stats| {
+                    stats.resident_bytes + stats.pooled_bytes > max_bytes
+                });
+            }
+        }
+
+        if let Some(max_pooled_bytes) = self.policy.max_pooled_bytes {
+            self.release_empty_arenas(|stats| stats.pooled_bytes > max_pooled_bytes);
+        }
+
+        for index in 0..self.arenas.len() {
+            if self.arenas[index]
+                .as_ref()
+                .map_or(false, GeometryArena::is_fragmented)
+            {
+                self.compact(device, queue, index);
+            }
+        }
+
+        self.frame += 1;
+    }
+
+    /// Drop every arena, keeping the policy and counters.
+    fn clear(&mut self) {
+        self.in_use.clear();
+        self.version += 1;
+        self.arenas.clear();
+        self.stats.resident = 0;
+        self.stats.resident_bytes = 0;
+        self.stats.pooled_bytes = 0;
+    }
+}
+
+/// How a painter renders, chosen at construction and changed with
+/// [`Painter::set_config`].
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct PainterConfig {
+    /// Samples per pixel for antialiasing. 1 disables multisampling; 1 and 4
+    /// are supported by every adapter.
+    pub sample_count: u32,
+    /// How frames are queued for the window. Ignored by headless painters.
+    pub present_mode: PresentMode,
+}
+
+impl Default for PainterConfig {
+    fn default() -> Self {
+        Self {
+            sample_count: 4,
+            present_mode: PresentMode::Fifo,
+        }
     }
 }
 
 // Represents a drawable surface
 pub struct Surface {
-    surface: wgpu::Surface,
+    /// `None` for a headless painter, which draws into its `readback` target.
+    surface: Option<wgpu::Surface>,
     surface_config: wgpu::SurfaceConfiguration,
     pub size: (u32, u32),
 }
@@ -823,7 +2353,12 @@ pub struct Surface {
 /// Object that manages the window and GPU resources
 pub struct Painter {
     surface: Surface,
-    multisampled_framebuffer: wgpu::TextureView,
+    readback: Option<readback::Readback>,
+    /// Whether flushed frames are copied into `readback` for reading.
+    read_back: bool,
+    config: PainterConfig,
+    /// `None` without multisampling, which draws straight into the target.
+    multisampled_framebuffer: Option<wgpu::TextureView>,
 
     device: wgpu::Device,
     queue: wgpu::Queue,
@@ -837,16 +2372,125 @@ pub struct Painter {
     old_transforms: Vec<cgmath::Matrix4<f32>>,
     uniform_bind_group_layout: wgpu::BindGroupLayout,
 
-    uniform_vec: Vec<Uniforms>,
-    uniform_buffer: UniformBuffer,
+    frame_buffers: Vec<FrameBuffers>,
+    /// The set of `frame_buffers` the current frame uses.
+    frame_index: usize,
+
+    instance_vec: Vec<Instance>,
+
+    tessellator: tessellation::Tessellator,
+    tessellation_mode: TessellationMode,
+    tessellation_pool: Option<tessellation::TessellationPool>,
+    pending_geometry: HashSet<UniqueGeometry>,
+    recording: Option<Recording>,
+    /// The cached geometry handed to recorders, and the version of the
+    /// geometry store it was taken at.
+    cached_snapshot: Option<(u64, Arc<HashSet<UniqueGeometry>>)>,
+
+    text_mode: TextMode,
+    glyph_atlas: atlas::GlyphAtlas,
+    glyph_instance_vec: Vec<atlas::GlyphInstance>,
+
+    shape_mode: ShapeMode,
+    shape_instance_vec: Vec<shape::ShapeInstance>,
+    /// Created on first use, as painters without analytic shapes never need it.
+    shape_pipeline: Option<wgpu::RenderPipeline>,
+
+    path_rasterizer: PathRasterizer,
+    /// Whether the adapter runs compute shaders, which the compute path
+    /// rasterizer needs.
+    compute_supported: bool,
+    /// Created once the compute path rasterizer is selected.
+    path_raster: Option<raster::PathRaster>,
+
+    compositor: composite::Compositor,
+
+    damage_tracking: bool,
+    /// Created on first use, as only damage tracking needs it.
+    clear_pipeline: Option<wgpu::RenderPipeline>,
+    /// The commands drawn into `multisampled_framebuffer` by the last frame,
+    /// `None` when its contents cannot be reused.
+    previous_frame: Option<Vec<DrawnCommand>>,
+
+    /// Holds frames drawn by [`Painter::end_frame`] without multisampling.
+    frame_target: Option<composite::LayerTexture>,
+    /// Whether a frame drawn by [`Painter::end_frame`] waits for [`Painter::present`].
+    frame_pending: bool,
+
+    profiler: profiler::Profiler,
+    /// Counters kept by the painter itself, see [`Painter::stats`].
+    stats: PainterStats,
+    frame_stats: FrameStats,
+}
+
+// Painters may be created on a loading thread, see `Painter::new_from_window`.
+const _: fn() = || {
+    fn assert_send<T: Send>() {}
+    assert_send::<Painter>();
+};
+
+/// Blending of the geometry, glyph and shape pipelines. Color is blended
+/// over the target, and coverage accumulates in alpha, so that drawing into a
+/// cleared layer texture leaves it premultiplied.
+pub(crate) const PREMULTIPLIED_BLEND: wgpu::BlendState = wgpu::BlendState {
+    color: wgpu::BlendComponent {
+        src_factor: wgpu::BlendFactor::SrcAlpha,
+        dst_factor: wgpu::BlendFactor::OneMinusSrcAlpha,
+        operation: wgpu::BlendOperation::Add,
+    },
+    alpha: wgpu::BlendComponent {
+        src_factor: wgpu::BlendFactor::One,
+        dst_factor: wgpu::BlendFactor::OneMinusSrcAlpha,
+        operation: wgpu::BlendOperation::Add,
+    },
+};
+
+impl Draw for Painter {
+    fn transform(&self) -> &cgmath::Matrix4<f32> {
+        &self.transform
+    }
+
+    fn geometry(
+        &mut self,
+        uniq: &UniqueGeometry,
+        job: impl FnOnce() -> Option<tessellation::Job>,
+    ) -> bool {
+        self.cache(uniq, job)
+    }
+
+    fn push(&mut self, command: Command) {
+        self.commands().push(command);
+    }
+
+    fn shape_mode(&self) -> ShapeMode {
+        self.shape_mode
+    }
+
+    fn path_rasterizer(&self) -> PathRasterizer {
+        self.path_rasterizer
+    }
 }
 
 impl Painter {
     /// Create a new painter with the given window
+    ///
+    /// Painters are `Send`, so if device setup holds up startup, the painter
+    /// can be created on another thread while the app shows its first frame,
+    /// then sent to the thread drawing with it.
     pub async fn new_from_window(
         window: &impl raw_window_handle::HasRawWindowHandle,
         size: (u32, u32),
         backends: Backends,
+    ) -> Self {
+        Self::new_from_window_with_config(window, size, backends, PainterConfig::default()).await
+    }
+
+    /// Create a new painter with the given window and configuration
+    pub async fn new_from_window_with_config(
+        window: &impl raw_window_handle::HasRawWindowHandle,
+        size: (u32, u32),
+        backends: Backends,
+        painter_config: PainterConfig,
     ) -> Self {
         let instance = wgpu::Instance::new(backends);
         let surface = unsafe { instance.create_surface(window) };
@@ -859,17 +2503,7 @@ impl Painter {
             .await
             .unwrap();
 
-        let (device, queue) = adapter
-            .request_device(
-                &wgpu::DeviceDescriptor {
-                    label: None,
-                    features: wgpu::Features::empty(),
-                    limits: wgpu::Limits::downlevel_defaults().using_resolution(adapter.limits()),
-                },
-                None,
-            )
-            .await
-            .unwrap();
+        let (device, queue, compute_supported) = Self::request_device(&adapter).await.unwrap();
 
         let swapchain_format = surface.get_preferred_format(&adapter).unwrap();
 
@@ -878,10 +2512,101 @@ impl Painter {
             format: swapchain_format,
             width: size.0,
             height: size.1,
-            present_mode: wgpu::PresentMode::Fifo,
+            present_mode: painter_config.present_mode,
         };
         surface.configure(&device, &config);
 
+        Self::from_device(
+            device,
+            queue,
+            Some(surface),
+            config,
+            painter_config,
+            compute_supported,
+        )
+    }
+
+    /// Create a painter that draws into an offscreen texture of the given size
+    /// instead of a window. Frames are read back with [`Painter::read_pixels`].
+    /// Returns `None` if there is no suitable adapter.
+    pub async fn new_headless(size: (u32, u32), backends: Backends) -> Option<Self> {
+        Self::new_headless_with_config(size, backends, PainterConfig::default()).await
+    }
+
+    /// Create a headless painter with the given configuration
+    pub async fn new_headless_with_config(
+        size: (u32, u32),
+        backends: Backends,
+        painter_config: PainterConfig,
+    ) -> Option<Self> {
+        let instance = wgpu::Instance::new(backends);
+        let adapter = instance
+            .request_adapter(&wgpu::RequestAdapterOptions {
+                power_preference: wgpu::PowerPreference::default(),
+                compatible_surface: None,
+                force_fallback_adapter: false,
+            })
+            .await?;
+
+        let (device, queue, compute_supported) = Self::request_device(&adapter).await.ok()?;
+
+        // Only describes the offscreen target, which is never configured.
+        let config = wgpu::SurfaceConfiguration {
+            usage: wgpu::TextureUsages::RENDER_ATTACHMENT,
+            format: wgpu::TextureFormat::Rgba8UnormSrgb,
+            width: size.0.max(1),
+            height: size.1.max(1),
+            present_mode: painter_config.present_mode,
+        };
+
+        Some(Self::from_device(
+            device,
+            queue,
+            None,
+            config,
+            painter_config,
+            compute_supported,
+        ))
+    }
+
+    /// Request the device and queue of a painter from `adapter`, and whether
+    /// it can run compute shaders.
+    async fn request_device(
+        adapter: &wgpu::Adapter,
+    ) -> Result<(wgpu::Device, wgpu::Queue, bool), wgpu::RequestDeviceError> {
+        let (device, queue) = adapter
+            .request_device(
+                &wgpu::DeviceDescriptor {
+                    label: None,
+                    // Optional, so only requested where the adapter has them.
+                    features: adapter.features() & profiler::FEATURES,
+                    limits: wgpu::Limits::downlevel_defaults().using_resolution(adapter.limits()),
+                },
+                None,
+            )
+            .await?;
+        let compute_supported = adapter
+            .get_downlevel_properties()
+            .flags
+            .contains(wgpu::DownlevelFlags::COMPUTE_SHADERS);
+        Ok((device, queue, compute_supported))
+    }
+
+    fn from_device(
+        device: wgpu::Device,
+        queue: wgpu::Queue,
+        surface: Option<wgpu::Surface>,
+        config: wgpu::SurfaceConfiguration,
+        painter_config: PainterConfig,
+        compute_supported: bool,
+    ) -> Self {
+        let sample_count = painter_config.sample_count;
+        let size = (config.width, config.height);
+        let readback = match surface {
+            Some(_) => None,
+            None => Some(readback::Readback::new(&device, config.format, size)),
+        };
+
         let uniform_bind_group_layout =
             device.create_bind_group_layout(&wgpu::BindGroupLayoutDescriptor {
                 entries: &[wgpu::BindGroupLayoutEntry {
@@ -889,7 +2614,7 @@ impl Painter {
                     visibility: wgpu::ShaderStages::VERTEX,
                     ty: wgpu::BindingType::Buffer {
                         ty: wgpu::BufferBindingType::Uniform,
-                        has_dynamic_offset: true,
+                        has_dynamic_offset: false,
                         min_binding_size: wgpu::BufferSize::new(
                             std::mem::size_of::<Uniforms>() as _
                         ),
@@ -899,6 +2624,77 @@ impl Painter {
                 label: Some("Uniform Bind Group Layout"),
             });
 
+        let render_pipeline = Self::create_render_pipeline(
+            &device,
+            &uniform_bind_group_layout,
+            config.format,
+            sample_count,
+        );
+
+        let multisampled_framebuffer =
+            Self::create_multisampled_framebuffer(&device, config.format, size, sample_count);
+
+        let frame_buffers = (0..FRAMES_IN_FLIGHT)
+            .map(|_| FrameBuffers::new(&device, &uniform_bind_group_layout))
+            .collect();
+        // The other pipelines are created on first use, see `create_pipelines`.
+        let glyph_atlas = atlas::GlyphAtlas::new(&device);
+        let compositor = composite::Compositor::new(&device);
+
+        Self {
+            surface: Surface {
+                surface,
+                surface_config: config,
+                size: size,
+            },
+            readback,
+            read_back: true,
+            config: painter_config,
+            device: device,
+            queue: queue,
+            render_pipeline,
+            stack: Vec::new(),
+            geometry_buffers: GeometryStore::new(RetentionPolicy::default()),
+            uniform_bind_group_layout,
+            transform: cgmath::Matrix4::identity(),
+            old_transforms: Vec::new(),
+            multisampled_framebuffer,
+            frame_buffers,
+            frame_index: 0,
+            instance_vec: Vec::new(),
+            tessellator: tessellation::Tessellator::new(),
+            tessellation_mode: TessellationMode::default(),
+            tessellation_pool: None,
+            pending_geometry: HashSet::new(),
+            recording: None,
+            cached_snapshot: None,
+            text_mode: TextMode::default(),
+            glyph_atlas,
+            glyph_instance_vec: Vec::new(),
+            shape_mode: ShapeMode::default(),
+            shape_instance_vec: Vec::new(),
+            shape_pipeline: None,
+            path_rasterizer: PathRasterizer::default(),
+            compute_supported,
+            path_raster: None,
+            compositor,
+            damage_tracking: false,
+            clear_pipeline: None,
+            previous_frame: None,
+            frame_target: None,
+            frame_pending: false,
+            profiler: profiler::Profiler::new(),
+            stats: PainterStats::default(),
+            frame_stats: FrameStats::default(),
+        }
+    }
+
+    fn create_render_pipeline(
+        device: &wgpu::Device,
+        uniform_bind_group_layout: &wgpu::BindGroupLayout,
+        format: wgpu::TextureFormat,
+        sample_count: u32,
+    ) -> wgpu::RenderPipeline {
         let shader = device.create_shader_module(&wgpu::ShaderModuleDescriptor {
             label: Some("Shader"),
             source: wgpu::ShaderSource::Wgsl(include_str!("shader.wgsl").into()),
@@ -907,35 +2703,24 @@ impl Painter {
         let render_pipeline_layout =
             device.create_pipeline_layout(&wgpu::PipelineLayoutDescriptor {
                 label: Some("Render Pipeline Layout"),
-                bind_group_layouts: &[&uniform_bind_group_layout],
+                bind_group_layouts: &[uniform_bind_group_layout],
                 push_constant_ranges: &[],
             });
 
-        let render_pipeline = device.create_render_pipeline(&wgpu::RenderPipelineDescriptor {
+        device.create_render_pipeline(&wgpu::RenderPipelineDescriptor {
             label: Some("Render Pipeline"),
             layout: Some(&render_pipeline_layout),
             vertex: wgpu::VertexState {
                 module: &shader,
                 entry_point: "main",
-                buffers: &[Vertex::desc()],
+                buffers: &[Vertex::desc(), Instance::desc()],
             },
             fragment: Some(wgpu::FragmentState {
                 module: &shader,
                 entry_point: "main",
                 targets: &[wgpu::ColorTargetState {
-                    format: config.format,
-                    blend: Some(wgpu::BlendState {
-                        color: wgpu::BlendComponent {
-                            src_factor: wgpu::BlendFactor::SrcAlpha,
-                            dst_factor: wgpu::BlendFactor::OneMinusSrcAlpha,
-                            operation: wgpu::BlendOperation::Add,
-                        },
-                        alpha: wgpu::BlendComponent {
-                            src_factor: wgpu::BlendFactor::SrcAlpha,
-                            dst_factor: wgpu::BlendFactor::OneMinusSrcAlpha,
-                            operation: wgpu::BlendOperation::Add,
-                        },
-                    }),
+                    format,
+                    blend: Some(PREMULTIPLIED_BLEND),
                     write_mask: wgpu::ColorWrites::ALL,
                 }],
             }),
@@ -953,44 +2738,26 @@ impl Painter {
             },
             depth_stencil: None,
             multisample: wgpu::MultisampleState {
-                count: 4,
+                count: sample_count,
                 mask: !0,
                 alpha_to_coverage_enabled: false,
             },
-        });
-
-        let multisampled_framebuffer = Self::create_multisampled_framebuffer(&device, &config, 4);
-
-        let uniform_buffer = UniformBuffer::new(&device, 100, &uniform_bind_group_layout);
-
-        Self {
-            surface: Surface {
-                surface,
-                surface_config: config,
-                size: size,
-            },
-            device: device,
-            queue: queue,
-            render_pipeline,
-            stack: Vec::new(),
-            geometry_buffers: GeometryStore::new(),
-            uniform_bind_group_layout,
-            transform: cgmath::Matrix4::identity(),
-            old_transforms: Vec::new(),
-            multisampled_framebuffer,
-            uniform_vec: Vec::new(),
-            uniform_buffer: uniform_buffer,
-        }
+        })
     }
 
     fn create_multisampled_framebuffer(
         device: &wgpu::Device,
-        config: &wgpu::SurfaceConfiguration,
+        format: wgpu::TextureFormat,
+        (width, height): (u32, u32),
         sample_count: u32,
-    ) -> wgpu::TextureView {
+    ) -> Option<wgpu::TextureView> {
+        if sample_count == 1 {
+            return None;
+        }
+
         let multisampled_texture_extent = wgpu::Extent3d {
-            width: config.width,
-            height: config.height,
+            width,
+            height,
             depth_or_array_layers: 1,
         };
         let multisampled_frame_descriptor = &wgpu::TextureDescriptor {
@@ -998,14 +2765,16 @@ impl Painter {
             mip_level_count: 1,
             sample_count,
             dimension: wgpu::TextureDimension::D2,
-            format: config.format,
+            format,
             usage: wgpu::TextureUsages::RENDER_ATTACHMENT,
             label: None,
         };
 
-        device
-            .create_texture(multisampled_frame_descriptor)
-            .create_view(&wgpu::TextureViewDescriptor::default())
+        Some(
+            device
+                .create_texture(multisampled_frame_descriptor)
+                .create_view(&wgpu::TextureViewDescriptor::default()),
+        )
     }
 
     /// Scale the transform by the given factor.
@@ -1033,13 +2802,35 @@ impl Painter {
         self.transform = self.old_transforms.pop().unwrap();
     }
 
-    /// Reset the transform.
-    pub fn reset(&mut self) {
-        self.transform = cgmath::Matrix4::identity();
+    /// Reset the transform.
+    pub fn reset(&mut self) {
+        self.transform = cgmath::Matrix4::identity();
+    }
+
+    /// Fill the given text. `wrap_limit` can be used to limit the amount of characters in a line.
+    pub fn fill_text(
+        &mut self,
+        font: &Font,
+        text: &str,
+        x: f32,
+        y: f32,
+        size: f32,
+        color: Color,
+        wrap_limit: Option<usize>,
+    ) {
+        let screen_size = size * transform_scale(&self.transform);
+        if let TextMode::Atlas { max_size } = self.text_mode {
+            if screen_size <= max_size {
+                return self.fill_text_atlas(font, text, x, y, size, color, wrap_limit);
+            }
+        }
+
+        draw_glyphs(self, font, text, x, y, size, color, wrap_limit);
     }
 
-    /// Fill the given text. `wrap_limit` can be used to limit the amount of characters in a line.
-    pub fn fill_text(
+    /// Fill text with glyphs from the atlas, rasterized at the on-screen size
+    /// rounded up to its size bucket, see `atlas::bucket_size`.
+    fn fill_text_atlas(
         &mut self,
         font: &Font,
         text: &str,
@@ -1049,43 +2840,38 @@ impl Painter {
         color: Color,
         wrap_limit: Option<usize>,
     ) {
-        match wrap_limit {
-            Some(limit) => assert_ne!(limit, 0),
-            None => (),
-        }
-        let face = font.font.as_face_ref();
-        let default_scale = (face.units_per_em().unwrap() as f32).recip();
-        let mut path = PathBuilder::new();
-        let bbox = face.global_bounding_box();
-        let line_height = (bbox.y_min + bbox.y_max) as f32;
-        let line_height = line_height * 1.2;
-        let glyph_width = (bbox.x_min + bbox.x_max) as f32;
-        path.translate(x, y);
-        path.scale(default_scale * size, default_scale * size);
-        path.translate(0., line_height);
-        let mut offset = 0.;
-        for (i, character) in text.chars().enumerate() {
-            if character == '\n' {
-                path.translate(-offset, line_height);
-                offset = 0.;
-                continue;
-            }
-            let glyph = face.as_face_ref().glyph_index(character).unwrap();
-            face.outline_glyph(glyph, &mut path);
-            let advance = face.glyph_hor_advance(glyph).unwrap() as f32;
-            offset += advance;
-            path.translate(advance, 0.);
-            match wrap_limit {
-                Some(limit) => {
-                    if offset > glyph_width * limit as f32 && character == ' ' {
-                        path.translate(-offset, line_height);
-                        offset = 0.;
-                    }
-                }
-                None => (),
-            }
-        }
-        self.fill_path(&path.build(), color);
+        let units_per_em = font.font.as_face_ref().units_per_em().unwrap() as f32;
+        let scale = size / units_per_em;
+        let screen_size = size * transform_scale(&self.transform);
+        let pixel_size = atlas::bucket_size(screen_size) as f32;
+        // Size of an atlas texel in painter units.
+        let texel = size / pixel_size;
+
+        font.layout(text, wrap_limit, |glyph, offset, line| {
+            let entry = match self.glyph_atlas.glyph(
+                &self.device,
+                &self.queue,
+                font,
+                glyph,
+                pixel_size as u16,
+            ) {
+                Some(entry) => entry,
+                None => return,
+            };
+
+            let placement = Instance::placed(
+                &self.transform,
+                x + offset * scale + entry.origin[0] * texel,
+                y + line * scale + entry.origin[1] * texel,
+                entry.size[0] * texel,
+                entry.size[1] * texel,
+                color,
+            );
+            self.commands().push(Command::AtlasGlyph {
+                page: entry.page,
+                instance: atlas::GlyphInstance::new(placement, &entry),
+            });
+        });
     }
 
     /// Stroke the given text. `wrap_limit` can be used to limit the amount of characters in a line.
@@ -1100,43 +2886,7 @@ impl Painter {
         options: StrokeOptions,
         wrap_limit: Option<usize>,
     ) {
-        match wrap_limit {
-            Some(limit) => assert_ne!(limit, 0),
-            None => (),
-        }
-        let face = font.font.as_face_ref();
-        let default_scale = (face.units_per_em().unwrap() as f32).recip();
-        let mut path = PathBuilder::new();
-        let bbox = face.global_bounding_box();
-        let line_height = (bbox.y_min + bbox.y_max) as f32;
-        let line_height = line_height * 1.2;
-        let glyph_width = (bbox.x_min + bbox.x_max) as f32;
-        path.translate(x, y);
-        path.scale(default_scale * size, default_scale * size);
-        path.translate(0., line_height);
-        let mut offset = 0.;
-        for (i, character) in text.chars().enumerate() {
-            if character == '\n' {
-                path.translate(-offset, line_height);
-                offset = 0.;
-                continue;
-            }
-            let glyph = face.as_face_ref().glyph_index(character).unwrap();
-            face.outline_glyph(glyph, &mut path);
-            let advance = face.glyph_hor_advance(glyph).unwrap() as f32;
-            offset += advance;
-            path.translate(advance, 0.);
-            match wrap_limit {
-                Some(limit) => {
-                    if offset > glyph_width * limit as f32 && character == ' ' {
-                        path.translate(-offset, line_height);
-                        offset = 0.;
-                    }
-                }
-                None => (),
-            }
-        }
-        self.stroke_path(&path.build(), color, options);
+        draw_stroked_glyphs(self, font, text, x, y, size, color, options, wrap_limit);
     }
 
     // measure the width of the given text
@@ -1186,404 +2936,1557 @@ impl Painter {
             self.surface.surface_config.height = new_size.1;
             self.multisampled_framebuffer = Self::create_multisampled_framebuffer(
                 &self.device,
-                &self.surface.surface_config,
-                4,
+                self.surface.surface_config.format,
+                new_size,
+                self.config.sample_count,
+            );
+            self.previous_frame = None;
+            self.frame_target = None;
+            self.frame_pending = false;
+            match &self.surface.surface {
+                Some(surface) => surface.configure(&self.device, &self.surface.surface_config),
+                None => {
+                    let format = self.surface.surface_config.format;
+                    self.readback = Some(readback::Readback::new(&self.device, format, new_size));
+                }
+            }
+        }
+    }
+
+    pub fn regen(&mut self) {
+        if let Some(surface) = &self.surface.surface {
+            surface.configure(&self.device, &self.surface.surface_config);
+        }
+    }
+
+    /// Copy the oldest flushed frame of a headless painter that was not read
+    /// yet into `pixels`, as rows of RGBA pixels in sRGB without padding.
+    ///
+    /// Two frames are kept for reading, so a frame can be read while the next
+    /// one renders; flushing a third drops the oldest. With `wait`, this blocks
+    /// until the readback finishes, otherwise it returns false while it is in
+    /// flight. Also returns false if there is no frame to read, the painter has
+    /// a window, or `pixels` is smaller than a frame.
+    pub fn read_pixels(&mut self, pixels: &mut [u8], wait: bool) -> bool {
+        match &mut self.readback {
+            Some(readback) if pixels.len() >= readback.frame_size() => {
+                readback.read(&self.device, pixels, wait)
+            }
+            _ => false,
+        }
+    }
+
+    /// Draw a rectangle.
+    pub fn rectangle(&mut self, x: f32, y: f32, width: f32, height: f32, color: Color) {
+        draw_rectangle(self, x, y, width, height, color);
+    }
+
+    /// Stroke the given path
+    pub fn stroke_path(&mut self, path_builder: &Path, color: Color, options: StrokeOptions) {
+        draw_stroke_path(self, path_builder, color, options);
+    }
+
+    /// Fill the given path
+    pub fn fill_path(&mut self, path_builder: &Path, color: Color) {
+        draw_fill_path(self, path_builder, color);
+    }
+
+    /// Make sure `uniq` is in the geometry cache, tessellating the job made by
+    /// `job` on a miss. While recording a layer the job is always made, so the
+    /// layer can tessellate it again. Returns false if there is nothing to draw.
+    fn cache(
+        &mut self,
+        uniq: &UniqueGeometry,
+        job: impl FnOnce() -> Option<tessellation::Job>,
+    ) -> bool {
+        let lookup = self.profiler.start();
+        let cached = self.geometry_buffers.contains(uniq);
+        self.profiler.record_lookup(lookup);
+        count_lookup(&mut self.stats, uniq, cached);
+        let record = match &self.recording {
+            Some(recording) => !recording.jobs.contains_key(uniq),
+            None => false,
+        };
+        // Geometry already queued to the pool needs no job of its own.
+        if !record && (cached || self.pending_geometry.contains(uniq)) {
+            return true;
+        }
+
+        let job = match job() {
+            Some(job) => job,
+            None => return false,
+        };
+        if record {
+            let recording = self.recording.as_mut().unwrap();
+            recording.jobs.insert(uniq.clone(), job.clone());
+        }
+        if !cached {
+            self.tessellate(uniq.clone(), job);
+        }
+        true
+    }
+
+    /// Run a tessellation job now, or queue it to the worker pool if there is one.
+    fn tessellate(&mut self, uniq: UniqueGeometry, job: tessellation::Job) {
+        match (&self.tessellation_pool, &job) {
+            // Unit shapes are cheap and shared by every rectangle and circle, so
+            // they never wait for the pool.
+            (Some(pool), tessellation::Job::Fill(..) | tessellation::Job::Stroke(..)) => {
+                if self.pending_geometry.insert(uniq.clone()) {
+                    pool.submit(uniq, job);
+                }
+            }
+            _ => self.tessellate_now(uniq, job),
+        }
+    }
+
+    /// Run a tessellation job on the calling thread and cache its geometry.
+    fn tessellate_now(&mut self, uniq: UniqueGeometry, job: tessellation::Job) {
+        let span = self.profiler.start();
+        let geometry = self.tessellator.tessellate(&job).unwrap();
+        self.frame_stats.count_geometry(&geometry);
+        self.geometry_buffers
+            .malloc(&self.device, &self.queue, uniq, geometry);
+        self.profiler.record("tessellate", span);
+    }
+
+    /// Upload the geometry finished by the worker pool. With `wait`, block
+    /// until every queued job is done.
+    fn collect_tessellations(&mut self, wait: bool) {
+        let pool = match &self.tessellation_pool {
+            Some(pool) => pool,
+            None => return,
+        };
+
+        loop {
+            let result = if wait && !self.pending_geometry.is_empty() {
+                Some(pool.result())
+            } else {
+                pool.try_result()
+            };
+            let (uniq, geometry) = match result {
+                Some(result) => result,
+                None => break,
+            };
+
+            self.pending_geometry.remove(&uniq);
+            // The same geometry may have been queued again after a `clear`.
+            if !self.geometry_buffers.in_use.contains_key(&uniq) {
+                self.frame_stats.count_geometry(&geometry.as_ref());
+                self.geometry_buffers
+                    .malloc(&self.device, &self.queue, uniq, geometry.as_ref());
+            }
+        }
+    }
+
+    /// Fill a cicle.
+    pub fn circle(&mut self, x: f32, y: f32, radius: f32, color: Color) {
+        draw_circle(self, x, y, radius, color);
+    }
+
+    /// Fill a rounded rectangle with the analytic shape pipeline.
+    pub fn rounded_rectangle(
+        &mut self,
+        x: f32,
+        y: f32,
+        width: f32,
+        height: f32,
+        radius: f32,
+        color: Color,
+    ) {
+        let (half_width, half_height) = (width / 2., height / 2.);
+        draw_rounded_rectangle(
+            self,
+            x + half_width,
+            y + half_height,
+            half_width,
+            half_height,
+            radius,
+            0.,
+            color,
+        );
+    }
+
+    /// Stroke a rounded rectangle with the analytic shape pipeline.
+    pub fn stroke_rounded_rectangle(
+        &mut self,
+        x: f32,
+        y: f32,
+        width: f32,
+        height: f32,
+        radius: f32,
+        color: Color,
+        line_width: f32,
+    ) {
+        let (half_width, half_height) = (width / 2., height / 2.);
+        draw_rounded_rectangle(
+            self,
+            x + half_width,
+            y + half_height,
+            half_width,
+            half_height,
+            radius,
+            line_width,
+            color,
+        );
+    }
+
+    /// Stroke a circle with the analytic shape pipeline.
+    pub fn stroke_circle(&mut self, x: f32, y: f32, radius: f32, color: Color, line_width: f32) {
+        draw_rounded_rectangle(self, x, y, radius, radius, radius, line_width, color);
+    }
+
+    /// Start recording a [`Layer`]. Until [`Painter::end_layer`], drawing goes
+    /// into the layer instead of the frame, relative to an identity transform.
+    /// Flushing while recording draws the frame without the layer, which keeps
+    /// recording.
+    pub fn begin_layer(&mut self) {
+        assert!(self.recording.is_none(), "layers cannot be nested");
+        self.recording = Some(Recording {
+            commands: Vec::new(),
+            atlas_generation: self.glyph_atlas.generation(),
+            transform: self.transform,
+            old_transforms: std::mem::take(&mut self.old_transforms),
+            jobs: HashMap::new(),
+        });
+        self.reset();
+    }
+
+    /// Finish recording a layer and restore the transform from before
+    /// [`Painter::begin_layer`].
+    pub fn end_layer(&mut self) -> Layer {
+        let recording = self
+            .recording
+            .take()
+            .expect("end_layer without begin_layer");
+        self.transform = recording.transform;
+        self.old_transforms = recording.old_transforms;
+        Layer {
+            commands: recording.commands,
+            jobs: recording.jobs,
+            atlas_generation: recording.atlas_generation,
+        }
+    }
+
+    /// Make a [`Recorder`] to draw with on another thread. It starts with the
+    /// current transform and knows the geometry cached right now.
+    pub fn recorder(&mut self) -> Recorder {
+        let version = self.geometry_buffers.version;
+        let cached = match &self.cached_snapshot {
+            Some((snapshot_version, cached)) if *snapshot_version == version => cached.clone(),
+            _ => {
+                let cached = Arc::new(self.geometry_buffers.in_use.keys().cloned().collect());
+                self.cached_snapshot = Some((version, Arc::clone(&cached)));
+                cached
+            }
+        };
+
+        Recorder {
+            commands: Vec::new(),
+            jobs: HashMap::new(),
+            cached,
+            version,
+            transform: self.transform,
+            old_transforms: Vec::new(),
+            lookups: PainterStats::default(),
+            shape_mode: self.shape_mode,
+            path_rasterizer: self.path_rasterizer,
+        }
+    }
+
+    /// Draw the commands of a recorder with the transforms it recorded them at,
+    /// tessellating the geometry it found missing. Recorders are merged in the
+    /// order of the calls, which is their drawing order.
+    ///
+    /// # Panics
+    ///
+    /// If a layer is being recorded, as the geometry a recorder skipped as
+    /// cached would be missing from the layer.
+    pub fn draw_recorder(&mut self, recorder: Recorder) {
+        assert!(
+            self.recording.is_none(),
+            "recorders cannot be drawn into a layer"
+        );
+        let span = self.profiler.start();
+        for (uniq, job) in recorder.jobs {
+            if !self.geometry_buffers.in_use.contains_key(&uniq) {
+                self.tessellate(uniq, job);
+            }
+        }
+        self.stats.add_lookups(&recorder.lookups);
+
+        // Geometry the recorder saw cached may have been evicted since, when it
+        // outlived the frame it was made in.
+        let stale = recorder.version != self.geometry_buffers.version;
+        let in_use = &self.geometry_buffers.in_use;
+        let pending = &self.pending_geometry;
+        let mut skipped = 0;
+        self.stack.extend(
+            recorder
+                .commands
+                .into_iter()
+                .filter(|command| match command {
+                    Command::RawGeometry { path, .. }
+                        if stale && !in_use.contains_key(path) && !pending.contains(path) =>
+                    {
+                        skipped += 1;
+                        false
+                    }
+                    _ => true,
+                }),
+        );
+        if skipped > 0 {
+            log::warn!(
+                "skipped {} commands of a recorder whose geometry was evicted",
+                skipped
+            );
+        }
+        self.profiler.record("draw recorder", span);
+    }
+
+    /// Draw a recorded layer with the current transform. The level of detail
+    /// of its geometry is the one it was recorded at. Drawn while recording
+    /// another layer, it becomes part of that layer.
+    pub fn draw_layer(&mut self, layer: &Layer) {
+        if let Some(recording) = &mut self.recording {
+            // The outer layer has to be able to tessellate this geometry again.
+            for (uniq, job) in layer.jobs.iter() {
+                recording
+                    .jobs
+                    .entry(uniq.clone())
+                    .or_insert_with(|| job.clone());
+            }
+        }
+        let commands = self.layer_commands(layer, self.transform);
+        self.commands().extend(commands);
+    }
+
+    /// The commands of `layer` placed by `transform`, tessellating the geometry
+    /// the cache is missing.
+    fn layer_commands(&mut self, layer: &Layer, transform: cgmath::Matrix4<f32>) -> Vec<Command> {
+        for (uniq, job) in layer.jobs.iter() {
+            if !self.geometry_buffers.in_use.contains_key(uniq) {
+                self.tessellate(uniq.clone(), job.clone());
+            }
+        }
+
+        // Atlas glyphs of a layer recorded before the atlas was cleared or
+        // evicted a page may point at texels that no longer hold them.
+        let atlas_valid = layer.atlas_generation == self.glyph_atlas.generation();
+        if !atlas_valid {
+            log::warn!("layer uses a cleared glyph atlas, its atlas text is skipped");
+        }
+
+        layer
+            .commands
+            .iter()
+            .filter_map(|command| match command {
+                Command::RawGeometry { path, instance } => Some(Command::RawGeometry {
+                    path: path.clone(),
+                    instance: Instance {
+                        transform: compose(&transform, &instance.transform),
+                        ..*instance
+                    },
+                }),
+                Command::AtlasGlyph { page, instance } if atlas_valid => {
+                    let mut instance = *instance;
+                    instance.transform = compose(&transform, &instance.transform);
+                    Some(Command::AtlasGlyph {
+                        page: *page,
+                        instance,
+                    })
+                }
+                Command::AtlasGlyph { .. } => None,
+                Command::Texture { texture, instance } => Some(Command::Texture {
+                    texture: texture.clone(),
+                    instance: Instance {
+                        transform: compose(&transform, &instance.transform),
+                        ..*instance
+                    },
+                }),
+                Command::Shape { instance } => {
+                    let mut instance = *instance;
+                    instance.transform = compose(&transform, &instance.transform);
+                    Some(Command::Shape { instance })
+                }
+                Command::RasterFill {
+                    path,
+                    instance,
+                    geometry,
+                } => Some(Command::RasterFill {
+                    path: path.clone(),
+                    instance: Instance {
+                        transform: compose(&transform, &instance.transform),
+                        ..*instance
+                    },
+                    geometry: geometry.clone(),
+                }),
+            })
+            .collect()
+    }
+
+    /// Render `layer` into a texture of `width` by `height` pixels, capturing
+    /// the layer from its origin at one pixel per unit.
+    pub fn render_layer(&mut self, layer: &Layer, width: u32, height: u32) -> CachedLayer {
+        let size = (width.max(1), height.max(1));
+
+        let commands = self.layer_commands(layer, cgmath::Matrix4::identity());
+        // The texture is kept, so it has to be complete.
+        self.collect_tessellations(true);
+
+        let format = self.surface.surface_config.format;
+        let texture = self
+            .compositor
+            .create_target(&self.device, format, size.0, size.1);
+        let multisampled = Self::create_multisampled_framebuffer(
+            &self.device,
+            format,
+            size,
+            self.config.sample_count,
+        );
+
+        let mut encoder = self
+            .device
+            .create_command_encoder(&wgpu::CommandEncoderDescriptor {
+                label: Some("Layer Encoder"),
+            });
+        let batches = self.prepare_batches(&commands, size, &Bounds::of_size(size), true);
+        self.create_pipelines_for(&batches, false);
+        if let Some(path_raster) = &self.path_raster {
+            path_raster.encode(&mut encoder);
+        }
+        self.draw_batches(
+            &mut encoder,
+            &batches,
+            multisampled.as_ref().unwrap_or(texture.view()),
+            multisampled.as_ref().map(|_| texture.view()),
+            None,
+        );
+        self.queue.submit(iter::once(encoder.finish()));
+
+        self.instance_vec.clear();
+        self.glyph_instance_vec.clear();
+        self.shape_instance_vec.clear();
+
+        CachedLayer {
+            texture: Arc::new(texture),
+            size,
+        }
+    }
+
+    /// Draw a cached layer with its origin at `(x, y)`, one unit per pixel of
+    /// its texture.
+    pub fn draw_cached_layer(&mut self, layer: &CachedLayer, x: f32, y: f32) {
+        let (width, height) = (layer.size.0 as f32, layer.size.1 as f32);
+        let transform = self.transform;
+        self.commands().push(Command::Texture {
+            texture: layer.texture.clone(),
+            instance: Instance::placed(
+                &transform,
+                x,
+                y,
+                width,
+                height,
+                Color::from_f(1., 1., 1., 1.),
+            ),
+        });
+    }
+
+    /// Where drawing goes: the layer being recorded, or the frame.
+    fn commands(&mut self) -> &mut Vec<Command> {
+        match &mut self.recording {
+            Some(recording) => &mut recording.commands,
+            None => &mut self.stack,
+        }
+    }
+
+    /// Useful for debugging. See [`Painter::stats`] for the numbers.
+    pub fn get_buffer_info(&self) -> String {
+        let stats = &self.geometry_buffers.stats;
+        let arenas = self.geometry_buffers.arenas.iter().flatten().count();
+        let total = stats.resident_bytes + stats.pooled_bytes;
+        format!(
+            "Arenas: {}\nGeometry in use: {}\nFree backpressure: {:.5}%\nUsed pressure: {:.5}%",
+            arenas,
+            stats.resident,
+            (stats.pooled_bytes as f32 / total as f32) * 100.0,
+            (stats.resident_bytes as f32 / total as f32) * 100.0
+        )
+    }
+
+    /// Set where geometry missing from the cache is tessellated.
+    pub fn set_tessellation_mode(&mut self, mode: TessellationMode) {
+        let threads = |mode| match mode {
+            TessellationMode::Immediate => None,
+            TessellationMode::Parallel { threads, .. } => Some(threads),
+        };
+        if threads(mode) != threads(self.tessellation_mode) {
+            self.collect_tessellations(true);
+            self.tessellation_pool = threads(mode).map(tessellation::TessellationPool::new);
+        }
+        self.tessellation_mode = mode;
+    }
+
+    /// Get where geometry missing from the cache is tessellated.
+    pub fn tessellation_mode(&self) -> TessellationMode {
+        self.tessellation_mode
+    }
+
+    /// Change the sample count or present mode. Cached geometry, glyphs and
+    /// layer textures are kept; only the pipelines and framebuffer are rebuilt.
+    pub fn set_config(&mut self, config: PainterConfig) {
+        let format = self.surface.surface_config.format;
+        if config.sample_count != self.config.sample_count {
+            let device = &self.device;
+            let layout = &self.uniform_bind_group_layout;
+            let sample_count = config.sample_count;
+            self.render_pipeline =
+                Self::create_render_pipeline(device, layout, format, sample_count);
+            self.glyph_atlas.reset_pipeline();
+            self.compositor.reset_pipeline();
+            self.shape_pipeline = None;
+            self.clear_pipeline = None;
+            self.multisampled_framebuffer = Self::create_multisampled_framebuffer(
+                device,
+                format,
+                self.surface.size,
+                sample_count,
             );
-            self.surface
-                .surface
-                .configure(&self.device, &self.surface.surface_config);
+            self.previous_frame = None;
+            self.frame_target = None;
+            self.frame_pending = false;
+        }
+        if config.present_mode != self.config.present_mode {
+            self.surface.surface_config.present_mode = config.present_mode;
+            self.regen();
+        }
+        self.config = config;
+    }
+
+    /// Get the sample count and present mode.
+    pub fn config(&self) -> PainterConfig {
+        self.config
+    }
+
+    /// Redraw only the part of the surface where the drawn commands differ
+    /// from the last frame, and skip frames that draw the same as the last one.
+    ///
+    /// The last frame is kept in the multisampled framebuffer, so nothing else
+    /// may draw onto the surface while this is enabled. Without multisampling
+    /// changed frames are redrawn in full.
+    pub fn set_damage_tracking(&mut self, enabled: bool) {
+        self.damage_tracking = enabled;
+        self.previous_frame = None;
+    }
+
+    /// Whether only the changed part of the surface is redrawn.
+    pub fn damage_tracking(&self) -> bool {
+        self.damage_tracking
+    }
+
+    /// Copy every flushed frame of a headless painter out for
+    /// [`Painter::read_pixels`]. Enabled by default; without it a flush only
+    /// renders, which keeps the copy and its synchronization out of
+    /// benchmarks. Has no effect on a painter with a window.
+    pub fn set_read_back(&mut self, enabled: bool) {
+        self.read_back = enabled;
+    }
+
+    /// Whether flushed frames of a headless painter are read back.
+    pub fn read_back(&self) -> bool {
+        self.read_back
+    }
+
+    /// Record where the time of every frame goes, see [`Painter::frame_profiles`].
+    /// The render pass is timed on the GPU as well if the adapter supports
+    /// timestamp queries. Enabling it again drops the recorded frames.
+    pub fn set_profiling(&mut self, enabled: bool) {
+        self.profiler
+            .set_enabled(&self.device, &self.queue, enabled);
+    }
+
+    /// Whether frames are profiled.
+    pub fn profiling(&self) -> bool {
+        self.profiler.enabled()
+    }
+
+    /// The most recent profiled frames, oldest first.
+    pub fn frame_profiles(&self) -> impl Iterator<Item = &FrameProfile> {
+        self.profiler.frames()
+    }
+
+    /// Write the profiled frames as Chrome trace JSON, for `chrome://tracing`
+    /// or Perfetto.
+    pub fn write_chrome_trace(&self, writer: &mut impl std::io::Write) -> std::io::Result<()> {
+        self.profiler.write_chrome_trace(writer)
+    }
+
+    /// Set how text is rendered.
+    pub fn set_text_mode(&mut self, mode: TextMode) {
+        self.text_mode = mode;
+    }
+
+    /// Get how text is rendered.
+    pub fn text_mode(&self) -> TextMode {
+        self.text_mode
+    }
+
+    /// Set how circles are rendered.
+    pub fn set_shape_mode(&mut self, mode: ShapeMode) {
+        self.shape_mode = mode;
+    }
+
+    /// Get how circles are rendered.
+    pub fn shape_mode(&self) -> ShapeMode {
+        self.shape_mode
+    }
+
+    /// Set how filled paths are rendered. The compute rasterizer needs an
+    /// adapter with compute shaders; without them fills stay tessellated.
+    pub fn set_path_rasterizer(&mut self, rasterizer: PathRasterizer) {
+        if rasterizer == PathRasterizer::Compute {
+            if !self.compute_supported {
+                log::warn!("the adapter has no compute shaders, fills stay tessellated");
+                return;
+            }
+            if self.path_raster.is_none() {
+                self.path_raster = Some(raster::PathRaster::new(&self.device, FRAMES_IN_FLIGHT));
+            }
         }
+        self.path_rasterizer = rasterizer;
     }
 
-    pub fn regen(&mut self) {
-        self.surface
-            .surface
-            .configure(&self.device, &self.surface.surface_config);
+    /// Get how filled paths are rendered.
+    pub fn path_rasterizer(&self) -> PathRasterizer {
+        self.path_rasterizer
     }
 
-    /// Draw a rectangle.
-    pub fn rectangle(&mut self, x: f32, y: f32, width: f32, height: f32, color: Color) {
-        use lyon::path::{builder::*, Winding};
-        use lyon::tessellation::geometry_builder::BuffersBuilder;
-        use lyon::tessellation::*;
-
-        let uniforms =
-            Uniforms::from_transform(self.transform, self.surface.size.0, self.surface.size.1);
-        self.uniform_vec
-            .extend_from_slice(bytemuck::cast_slice(&[uniforms]));
-
-        let uniq = UniqueGeometry::Rectangle(
-            OrderedFloat(x),
-            OrderedFloat(y),
-            OrderedFloat(width),
-            OrderedFloat(height),
-            color,
-        );
-        match self.geometry_buffers.in_use.get(&uniq) {
-            Some(buf) => {
-                self.stack.push(Command::RawGeometry {
-                    transform: self.transform.clone(),
-                    uniform_offset: (self.uniform_vec.len() - 1) as wgpu::BufferAddress,
-                    indices: buf.indices,
-                    path: uniq,
-                    vertices: buf.vertices,
-                });
-            }
-            None => {
-                let raw_color = color.as_array();
-
-                let mut geometry: VertexBuffers<Vertex, u16> = VertexBuffers::new();
-                let mut geometry_builder =
-                    BuffersBuilder::new(&mut geometry, |vertex: FillVertex| Vertex {
-                        position: vertex.position().to_array(),
-                        color: raw_color,
-                    });
-                let options = FillOptions::tolerance(0.1);
-                let mut tessellator = FillTessellator::new();
+    /// Set how long geometry stays cached after it was last drawn.
+    pub fn set_retention_policy(&mut self, policy: RetentionPolicy) {
+        self.geometry_buffers.policy = policy;
+    }
 
-                let mut builder = tessellator.builder(&options, &mut geometry_builder);
+    /// Get the current geometry retention policy.
+    pub fn retention_policy(&self) -> RetentionPolicy {
+        self.geometry_buffers.policy
+    }
 
-                builder.add_rectangle(&lyon::math::rect(x, y, width, height), Winding::Positive);
+    /// Get the geometry cache counters.
+    pub fn geometry_cache_stats(&self) -> GeometryCacheStats {
+        self.geometry_buffers.stats
+    }
 
-                builder.build().unwrap();
+    /// Get the cache, per frame and memory counters.
+    pub fn stats(&self) -> PainterStats {
+        let mut stats = self.stats;
+        let geometry = &self.geometry_buffers.stats;
+        stats.evictions = geometry.evictions;
+        stats.uploaded_bytes += geometry.uploaded_bytes;
+        stats.resident_geometries = geometry.resident as u64;
+        stats.geometry_resident_bytes = geometry.resident_bytes as u64;
+        stats.geometry_pooled_bytes = geometry.pooled_bytes as u64;
+        for buffers in self.frame_buffers.iter() {
+            stats.instance_buffer_bytes += (buffers.instance_buffer.mem_align.byte_size()
+                + buffers.glyph_instance_buffer.mem_align.byte_size()
+                + buffers.shape_instance_buffer.mem_align.byte_size())
+                as u64;
+            stats.uniform_buffer_bytes += buffers.uniform_buffer.byte_size as u64;
+        }
+        self.glyph_atlas.stats(&mut stats);
+        stats
+    }
 
-                while geometry.indices.len() * 2 % 4 != 0 {
-                    geometry.indices.push(0);
-                }
+    /// Clear all state & GPU buffers.
+    pub fn clear(&mut self) {
+        self.stack.clear();
+        self.recording = None;
+        self.instance_vec.clear();
+        self.glyph_instance_vec.clear();
+        self.shape_instance_vec.clear();
+        self.old_transforms.clear();
 
-                self.geometry_buffers.malloc(
-                    &self.device,
-                    &self.queue,
-                    uniq.clone(),
-                    &geometry.vertices,
-                    &geometry.indices,
-                );
+        self.geometry_buffers.clear();
+        self.glyph_atlas.clear();
+        self.previous_frame = None;
 
-                self.stack.push(Command::RawGeometry {
-                    transform: self.transform.clone(),
-                    uniform_offset: (self.uniform_vec.len() - 1) as wgpu::BufferAddress,
-                    indices: geometry.indices.len(),
-                    path: uniq,
-                    vertices: geometry.vertices.len(),
-                });
-            }
-        }
+        self.reset();
     }
 
-    /// Stroke the given path
-    pub fn stroke_path(&mut self, path_builder: &Path, color: Color, options: StrokeOptions) {
-        use lyon::tessellation::*;
-
-        let uniforms =
-            Uniforms::from_transform(self.transform, self.surface.size.0, self.surface.size.1);
-
-        self.uniform_vec
-            .extend_from_slice(bytemuck::cast_slice(&[uniforms]));
-
-        let uniq =
-            UniqueGeometry::StrokedPath(path_builder.path_instructions.clone(), color, options);
-        match self.geometry_buffers.in_use.get(&uniq) {
-            Some(buf) => {
-                self.stack.push(Command::RawGeometry {
-                    transform: self.transform.clone(),
-                    indices: buf.indices,
-                    uniform_offset: (self.uniform_vec.len() - 1) as wgpu::BufferAddress,
-                    path: uniq,
-                    vertices: buf.vertices,
-                });
-            }
-            None => {
-                let path = path_builder.path.clone().build();
-                let mut geometry: VertexBuffers<Vertex, u16> = VertexBuffers::new();
-                let mut tessellator = StrokeTessellator::new();
-                let raw_color = color.as_array();
-
-                {
-                    // Compute the tessellation.
-                    tessellator
-                        .tessellate_path(
-                            &path,
-                            &options.into(),
-                            &mut BuffersBuilder::new(&mut geometry, |vertex: StrokeVertex| {
-                                Vertex {
-                                    position: vertex.position().to_array(),
-                                    color: raw_color,
-                                }
-                            }),
-                        )
-                        .unwrap();
+    /// Cull `commands` to `viewport` on a target of `size` pixels, group them
+    /// into batches and upload their instances and the projection.
+    fn prepare_batches<'a>(
+        &mut self,
+        commands: &'a [Command],
+        size: (u32, u32),
+        viewport: &Bounds,
+        layer: bool,
+    ) -> Vec<Batch<'a>> {
+        // Commands entirely outside of the viewport are culled before encoding.
+
+        // Group consecutive commands drawing the same geometry into instanced batches.
+        let mut batches: Vec<Batch> = Vec::new();
+        if let Some(path_raster) = &mut self.path_raster {
+            path_raster.begin(size, layer);
+        }
+        for command in commands.iter() {
+            match command {
+                Command::RawGeometry { path, instance } => {
+                    // Skip geometry that is still being tessellated.
+                    let cached = match self.geometry_buffers.in_use.get(path) {
+                        Some(cached) => cached,
+                        None => continue,
+                    };
+                    if !cached
+                        .bounds
+                        .transformed(&instance.transform)
+                        .intersects(viewport)
+                    {
+                        continue;
+                    }
+                    push_geometry(&mut batches, &mut self.instance_vec, path, instance);
                 }
-
-                while geometry.indices.len() * 2 % 4 != 0 {
-                    geometry.indices.push(0);
+                Command::Texture { texture, instance } => {
+                    if !Bounds::UNIT
+                        .transformed(&instance.transform)
+                        .intersects(viewport)
+                    {
+                        continue;
+                    }
+                    let index = self.instance_vec.len() as u32;
+                    self.instance_vec.push(*instance);
+                    match batches.last_mut() {
+                        Some(Batch::Texture {
+                            texture: batch_texture,
+                            instances,
+                        }) if Arc::ptr_eq(batch_texture, texture) => instances.end = index + 1,
+                        _ => batches.push(Batch::Texture {
+                            texture,
+                            instances: index..index + 1,
+                        }),
+                    }
+                }
+                Command::AtlasGlyph { page, instance } => {
+                    if !Bounds::UNIT
+                        .transformed(&instance.transform)
+                        .intersects(viewport)
+                    {
+                        continue;
+                    }
+                    let index = self.glyph_instance_vec.len() as u32;
+                    self.glyph_instance_vec.push(*instance);
+                    match batches.last_mut() {
+                        Some(Batch::Glyphs {
+                            page: batch_page,
+                            instances,
+                        }) if batch_page == page => instances.end = index + 1,
+                        _ => batches.push(Batch::Glyphs {
+                            page: *page,
+                            instances: index..index + 1,
+                        }),
+                    }
+                }
+                Command::Shape { instance } => {
+                    if !Bounds::UNIT
+                        .transformed(&instance.transform)
+                        .intersects(viewport)
+                    {
+                        continue;
+                    }
+                    let index = self.shape_instance_vec.len() as u32;
+                    self.shape_instance_vec.push(*instance);
+                    match batches.last_mut() {
+                        Some(Batch::Shapes { instances }) => instances.end = index + 1,
+                        _ => batches.push(Batch::Shapes {
+                            instances: index..index + 1,
+                        }),
+                    }
                 }
+                Command::RasterFill {
+                    path,
+                    instance,
+                    geometry,
+                } => {
+                    let bounds = path.bounds.transformed(&instance.transform);
+                    if !bounds.intersects(viewport) {
+                        continue;
+                    }
+                    // Consecutive fills share a target, composited once it is
+                    // placed by `end`.
+                    let in_run = matches!(batches.last(), Some(Batch::Raster { .. }));
+                    let rasterize = match &self.path_raster {
+                        Some(path_raster) => in_run || path_raster.runs() < raster::MAX_RUNS,
+                        // Only made once the compute rasterizer is selected.
+                        None => false,
+                    };
+                    if !rasterize {
+                        // Tessellate right away, as geometry collected later
+                        // would miss this frame.
+                        let cached = self.geometry_buffers.in_use.contains_key(geometry);
+                        count_lookup(&mut self.stats, geometry, cached);
+                        if !cached {
+                            let lod = match geometry {
+                                UniqueGeometry::Path(_, lod) => *lod,
+                                _ => unreachable!("compute fills fall back to path geometry"),
+                            };
+                            self.tessellate_now(geometry.clone(), fill_job(path, lod));
+                        }
+                        push_geometry(&mut batches, &mut self.instance_vec, geometry, instance);
+                        continue;
+                    }
 
-                self.geometry_buffers.malloc(
-                    &self.device,
-                    &self.queue,
-                    uniq.clone(),
-                    &geometry.vertices,
-                    &geometry.indices,
-                );
+                    let path_raster = self.path_raster.as_mut().unwrap();
+                    if !in_run {
+                        let index = self.instance_vec.len() as u32;
+                        self.instance_vec.push(*instance);
+                        batches.push(Batch::Raster {
+                            run: path_raster.begin_run(),
+                            instances: index..index + 1,
+                        });
+                    }
+                    path_raster.fill(&path.path, &instance.transform, instance.color, &bounds);
+                }
+            }
+        }
 
-                self.stack.push(Command::RawGeometry {
-                    transform: self.transform.clone(),
-                    uniform_offset: (self.uniform_vec.len() - 1) as wgpu::BufferAddress,
-                    indices: geometry.indices.len(),
-                    path: uniq,
-                    vertices: geometry.vertices.len(),
-                });
+        if let Some(path_raster) = &mut self.path_raster {
+            path_raster.end();
+            for batch in batches.iter() {
+                if let Batch::Raster { run, instances } = batch {
+                    let ([x, y], [width, height]) = path_raster.placement(*run);
+                    self.instance_vec[instances.start as usize] = Instance::placed(
+                        &cgmath::Matrix4::identity(),
+                        x,
+                        y,
+                        width,
+                        height,
+                        Color::from_f(1., 1., 1., 1.),
+                    );
+                }
             }
         }
-    }
 
-    /// Fill the given path
-    pub fn fill_path(&mut self, path_builder: &Path, color: Color) {
-        use lyon::tessellation::*;
-
-        let uniforms =
-            Uniforms::from_transform(self.transform, self.surface.size.0, self.surface.size.1);
-        self.uniform_vec
-            .extend_from_slice(bytemuck::cast_slice(&[uniforms]));
-
-        let uniq = UniqueGeometry::Path(path_builder.path_instructions.clone(), color);
-        match self.geometry_buffers.in_use.get(&uniq) {
-            Some(buf) => {
-                self.stack.push(Command::RawGeometry {
-                    transform: self.transform.clone(),
-                    indices: buf.indices,
-                    uniform_offset: (self.uniform_vec.len() - 1) as wgpu::BufferAddress,
-                    path: uniq,
-                    vertices: buf.vertices,
-                });
+        let span = self.profiler.start();
+        let uniforms = Uniforms::from_size(size.0, size.1);
+        let buffers = &mut self.frame_buffers[self.frame_index];
+        self.queue.write_buffer(
+            &buffers.uniform_buffer.buffer,
+            0,
+            bytemuck::cast_slice(&[uniforms]),
+        );
+        buffers
+            .instance_buffer
+            .resize(&self.device, self.instance_vec.len());
+        self.queue.write_buffer(
+            &buffers.instance_buffer.buffer,
+            0,
+            bytemuck::cast_slice(&self.instance_vec),
+        );
+        buffers
+            .glyph_instance_buffer
+            .resize(&self.device, self.glyph_instance_vec.len());
+        self.queue.write_buffer(
+            &buffers.glyph_instance_buffer.buffer,
+            0,
+            bytemuck::cast_slice(&self.glyph_instance_vec),
+        );
+        buffers
+            .shape_instance_buffer
+            .resize(&self.device, self.shape_instance_vec.len());
+        self.queue.write_buffer(
+            &buffers.shape_instance_buffer.buffer,
+            0,
+            bytemuck::cast_slice(&self.shape_instance_vec),
+        );
+        if let Some(path_raster) = &mut self.path_raster {
+            self.stats.uploaded_bytes += path_raster.upload(
+                &self.device,
+                &self.queue,
+                &self.compositor,
+                self.frame_index,
+            ) as u64;
+        }
+        self.profiler.record("upload", span);
+        let instances =
+            self.instance_vec.len() + self.glyph_instance_vec.len() + self.shape_instance_vec.len();
+        self.stats.uploaded_bytes += (std::mem::size_of_val(&uniforms)
+            + std::mem::size_of_val(&self.instance_vec[..])
+            + std::mem::size_of_val(&self.glyph_instance_vec[..])
+            + std::mem::size_of_val(&self.shape_instance_vec[..]))
+            as u64;
+        self.frame_stats.draw_calls += batches.len() as u64;
+        self.frame_stats.instances += instances as u64;
+
+        for batch in batches.iter() {
+            if let Batch::Geometry { path, .. } = batch {
+                self.geometry_buffers.touch(path);
             }
-            None => {
-                let path = path_builder.path.clone().build();
-                let options = FillOptions::tolerance(0.1);
-                let mut geometry: VertexBuffers<Vertex, u16> = VertexBuffers::new();
-                let mut tessellator = FillTessellator::new();
-                let raw_color = color.as_array();
-
-                {
-                    // Compute the tessellation.
-                    tessellator
-                        .tessellate_path(
-                            &path,
-                            &options,
-                            &mut BuffersBuilder::new(&mut geometry, |vertex: FillVertex| Vertex {
-                                position: vertex.position().to_array(),
-                                color: raw_color,
-                            }),
-                        )
-                        .unwrap();
-                }
+        }
 
-                while geometry.indices.len() * 2 % 4 != 0 {
-                    geometry.indices.push(0);
-                }
+        batches
+    }
 
-                self.geometry_buffers.malloc(
-                    &self.device,
-                    &self.queue,
-                    uniq.clone(),
-                    &geometry.vertices,
-                    &geometry.indices,
-                );
+    /// Create every pipeline now instead of on first use, for example while
+    /// the app shows its first frame. Only the pipeline drawing geometry is
+    /// created with the painter; the ones for atlas text, cached layers,
+    /// analytic shapes, damage tracking and the compute path rasterizer, once
+    /// selected, wait until a frame needs them.
+    pub fn create_pipelines(&mut self) {
+        let span = self.profiler.start();
+        self.create_glyph_pipeline();
+        self.create_texture_pipeline();
+        self.create_shape_pipeline();
+        self.create_clear_pipeline();
+        self.create_raster_pipeline();
+        self.profiler.record("pipelines", span);
+    }
 
-                self.stack.push(Command::RawGeometry {
-                    transform: self.transform.clone(),
-                    uniform_offset: (self.uniform_vec.len() - 1) as wgpu::BufferAddress,
-                    indices: geometry.indices.len(),
-                    path: uniq,
-                    vertices: geometry.vertices.len(),
-                });
+    /// Create the pipelines `batches` need, and the clear pipeline if `clear`.
+    fn create_pipelines_for(&mut self, batches: &[Batch], clear: bool) {
+        let mut glyphs = false;
+        let mut textures = false;
+        let mut shapes = false;
+        let mut rasters = false;
+        for batch in batches.iter() {
+            match batch {
+                Batch::Geometry { .. } => {}
+                Batch::Glyphs { .. } => glyphs = true,
+                Batch::Texture { .. } => textures = true,
+                Batch::Shapes { .. } => shapes = true,
+                Batch::Raster { .. } => rasters = true,
             }
         }
+
+        if glyphs {
+            self.create_glyph_pipeline();
+        }
+        if textures {
+            self.create_texture_pipeline();
+        }
+        if shapes {
+            self.create_shape_pipeline();
+        }
+        if rasters {
+            // Rasterized fills are composited like layers.
+            self.create_texture_pipeline();
+            self.create_raster_pipeline();
+        }
+        if clear {
+            self.create_clear_pipeline();
+        }
     }
 
-    /// Fill a cicle.
-    pub fn circle(&mut self, x: f32, y: f32, radius: f32, color: Color) {
-        use lyon::path::{builder::*, Winding};
-        use lyon::tessellation::geometry_builder::BuffersBuilder;
-        use lyon::tessellation::*;
-
-        let uniforms =
-            Uniforms::from_transform(self.transform, self.surface.size.0, self.surface.size.1);
-        self.uniform_vec
-            .extend_from_slice(bytemuck::cast_slice(&[uniforms]));
-
-        let uniq = UniqueGeometry::Circle(
-            OrderedFloat(x),
-            OrderedFloat(y),
-            OrderedFloat(radius),
-            color,
+    fn create_glyph_pipeline(&mut self) {
+        self.glyph_atlas.create_pipeline(
+            &self.device,
+            &self.uniform_bind_group_layout,
+            self.surface.surface_config.format,
+            self.config.sample_count,
         );
-        match self.geometry_buffers.in_use.get(&uniq) {
-            Some(buf) => {
-                self.stack.push(Command::RawGeometry {
-                    transform: self.transform.clone(),
-                    uniform_offset: (self.uniform_vec.len() - 1) as wgpu::BufferAddress,
-                    indices: buf.indices,
-                    path: uniq,
-                    vertices: buf.vertices,
-                });
-            }
-            None => {
-                let raw_color = color.as_array();
+    }
 
-                let mut geometry: VertexBuffers<Vertex, u16> = VertexBuffers::new();
-                let mut geometry_builder =
-                    BuffersBuilder::new(&mut geometry, |vertex: FillVertex| Vertex {
-                        position: vertex.position().to_array(),
-                        color: raw_color,
-                    });
-                let options = FillOptions::tolerance(0.1);
-                let mut tessellator = FillTessellator::new();
+    fn create_texture_pipeline(&mut self) {
+        self.compositor.create_pipeline(
+            &self.device,
+            &self.uniform_bind_group_layout,
+            self.surface.surface_config.format,
+            self.config.sample_count,
+        );
+    }
 
-                let mut builder = tessellator.builder(&options, &mut geometry_builder);
+    fn create_shape_pipeline(&mut self) {
+        if self.shape_pipeline.is_none() {
+            self.shape_pipeline = Some(shape::create_pipeline(
+                &self.device,
+                &self.uniform_bind_group_layout,
+                self.surface.surface_config.format,
+                self.config.sample_count,
+            ));
+        }
+    }
 
-                builder.add_circle(point(x, y), radius, Winding::Positive);
+    fn create_raster_pipeline(&mut self) {
+        if let Some(path_raster) = &mut self.path_raster {
+            path_raster.create_pipeline(&self.device);
+        }
+    }
 
-                builder.build().unwrap();
+    fn create_clear_pipeline(&mut self) {
+        if self.clear_pipeline.is_none() {
+            self.clear_pipeline = Some(composite::create_clear_pipeline(
+                &self.device,
+                self.surface.surface_config.format,
+                self.config.sample_count,
+            ));
+        }
+    }
 
-                while geometry.indices.len() * 2 % 4 != 0 {
-                    geometry.indices.push(0);
-                }
+    /// Draw `batches` into `view`, resolved into `resolve_target` if there is
+    /// one. With a `scissor` rectangle of `[x, y, width, height]`, only that
+    /// part is cleared and drawn, and the rest is kept.
+    fn draw_batches(
+        &self,
+        encoder: &mut wgpu::CommandEncoder,
+        batches: &[Batch],
+        view: &wgpu::TextureView,
+        resolve_target: Option<&wgpu::TextureView>,
+        scissor: Option<[u32; 4]>,
+    ) {
+        let buffers = &self.frame_buffers[self.frame_index];
+        let load = match scissor {
+            Some(_) => wgpu::LoadOp::Load,
+            None => wgpu::LoadOp::Clear(wgpu::Color {
+                r: 0.0,
+                g: 0.0,
+                b: 0.0,
+                a: 0.0,
+            }),
+        };
+        let mut render_pass = encoder.begin_render_pass(&wgpu::RenderPassDescriptor {
+            label: Some("Render Pass"),
+            color_attachments: &[wgpu::RenderPassColorAttachment {
+                view,
+                resolve_target,
+                ops: wgpu::Operations { load, store: true },
+            }],
+            depth_stencil_attachment: None,
+        });
 
-                self.geometry_buffers.malloc(
-                    &self.device,
-                    &self.queue,
-                    uniq.clone(),
-                    &geometry.vertices,
-                    &geometry.indices,
-                );
+        if let Some([x, y, width, height]) = scissor {
+            render_pass.set_scissor_rect(x, y, width, height);
+            render_pass.set_pipeline(self.clear_pipeline.as_ref().unwrap());
+            render_pass.draw(0..3, 0..1);
+        }
 
-                self.stack.push(Command::RawGeometry {
-                    transform: self.transform.clone(),
-                    uniform_offset: (self.uniform_vec.len() - 1) as wgpu::BufferAddress,
-                    indices: geometry.indices.len(),
-                    path: uniq,
-                    vertices: geometry.vertices.len(),
-                });
+        render_pass.set_bind_group(0, &buffers.uniform_buffer.bind_group, &[]);
+        // Every pipeline binds vertex buffer 0, so switching between them
+        // invalidates the bound arena and texture.
+        let mut bound_pipeline = None;
+        let mut bound_arena = None;
+        let mut bound_page = None;
+        for batch in batches.iter() {
+            match batch {
+                Batch::Geometry { path, instances } => {
+                    if bound_pipeline != Some(BoundPipeline::Geometry) {
+                        render_pass.set_pipeline(&self.render_pipeline);
+                        render_pass.set_vertex_buffer(1, buffers.instance_buffer.buffer.slice(..));
+                        bound_pipeline = Some(BoundPipeline::Geometry);
+                        bound_arena = None;
+                    }
+                    let allocation = &self.geometry_buffers.in_use[*path].allocation;
+                    let binding = (allocation.arena, allocation.index_format());
+                    if bound_arena != Some(binding) {
+                        let arena = self.geometry_buffers.arena(allocation.arena);
+                        render_pass.set_vertex_buffer(0, arena.vertex_buffer.slice(..));
+                        render_pass.set_index_buffer(arena.index_buffer.slice(..), binding.1);
+                        bound_arena = Some(binding);
+                    }
+                    render_pass.draw_indexed(
+                        allocation.index_range(),
+                        allocation.vertices.start as i32,
+                        instances.clone(),
+                    );
+                }
+                Batch::Glyphs { page, instances } => {
+                    if bound_pipeline != Some(BoundPipeline::Glyphs) {
+                        render_pass.set_pipeline(self.glyph_atlas.pipeline());
+                        render_pass
+                            .set_vertex_buffer(0, buffers.glyph_instance_buffer.buffer.slice(..));
+                        bound_pipeline = Some(BoundPipeline::Glyphs);
+                        bound_page = None;
+                    }
+                    if bound_page != Some(*page) {
+                        render_pass.set_bind_group(1, self.glyph_atlas.bind_group(*page), &[]);
+                        bound_page = Some(*page);
+                    }
+                    render_pass.draw(0..4, instances.clone());
+                }
+                Batch::Texture { texture, instances } => {
+                    if bound_pipeline != Some(BoundPipeline::Texture) {
+                        render_pass.set_pipeline(self.compositor.pipeline());
+                        render_pass.set_vertex_buffer(0, buffers.instance_buffer.buffer.slice(..));
+                        bound_pipeline = Some(BoundPipeline::Texture);
+                    }
+                    // Consecutive batches never share a texture.
+                    render_pass.set_bind_group(1, texture.bind_group(), &[]);
+                    render_pass.draw(0..4, instances.clone());
+                }
+                Batch::Raster { run, instances } => {
+                    if bound_pipeline != Some(BoundPipeline::Texture) {
+                        render_pass.set_pipeline(self.compositor.pipeline());
+                        render_pass.set_vertex_buffer(0, buffers.instance_buffer.buffer.slice(..));
+                        bound_pipeline = Some(BoundPipeline::Texture);
+                    }
+                    let texture = self.path_raster.as_ref().unwrap().target(*run);
+                    render_pass.set_bind_group(1, texture.bind_group(), &[]);
+                    render_pass.draw(0..4, instances.clone());
+                }
+                Batch::Shapes { instances } => {
+                    if bound_pipeline != Some(BoundPipeline::Shapes) {
+                        render_pass.set_pipeline(self.shape_pipeline.as_ref().unwrap());
+                        render_pass
+                            .set_vertex_buffer(0, buffers.shape_instance_buffer.buffer.slice(..));
+                        bound_pipeline = Some(BoundPipeline::Shapes);
+                    }
+                    render_pass.draw(0..4, instances.clone());
+                }
             }
         }
     }
 
-    /// Useful for debugging.
-    pub fn get_buffer_info(&self) -> String {
-        let mut free_backpressure = 0;
-        for buf in self.geometry_buffers.free.iter() {
-            free_backpressure += buf.vertices + buf.indices;
-        }
+    /// Flush the current state to the screen.
+    pub fn flush(&mut self) -> Result<(), wgpu::SurfaceError> {
+        // A frame drawn by `end_frame` and never presented is replaced.
+        self.frame_pending = false;
+        let (viewport, scissor) = match self.begin_frame() {
+            Some(damage) => damage,
+            None => return Ok(()),
+        };
+
+        let span = self.profiler.start();
+        let frame = match self
+            .surface
+            .surface
+            .as_ref()
+            .map(|surface| surface.get_current_texture())
+        {
+            Some(Ok(frame)) => Some(frame),
+            Some(Err(error)) => {
+                self.previous_frame = None;
+                self.profiler.record("acquire", span);
+                self.profiler.end_frame();
+                return Err(error);
+            }
+            None => None,
+        };
+        let view = match &frame {
+            Some(frame) => frame
+                .texture
+                .create_view(&wgpu::TextureViewDescriptor::default()),
+            None => self.readback.as_ref().unwrap().view(),
+        };
+        self.profiler.record("acquire", span);
 
-        let mut used_backpressure = 0;
-        for (_, buf) in self.geometry_buffers.in_use.iter() {
-            used_backpressure += buf.vertices + buf.indices;
+        self.submit_frame(FrameTarget::View(view), &viewport, scissor);
+
+        if let Some(frame) = frame {
+            let span = self.profiler.start();
+            frame.present();
+            self.profiler.record("present", span);
         }
+        self.profiler.end_frame();
 
-        let total_backpressure = free_backpressure + used_backpressure;
-        format!("Buffers free: {}\nBuffers in use: {}\nFree backpressure: {:.5}%\nUsed pressure: {:.5}%", self.geometry_buffers.free.len(), self.geometry_buffers.in_use.len(), (free_backpressure as f32 / total_backpressure as f32) * 100.0, (used_backpressure as f32 / total_backpressure as f32) * 100.0)
+        Ok(())
     }
 
-    /// Clear all state & GPU buffers.
-    pub fn clear(&mut self) {
-        self.stack.clear();
-        self.uniform_vec.clear();
-        self.old_transforms.clear();
-
-        self.geometry_buffers = GeometryStore::new();
+    /// Draw and submit the current frame without waiting for the surface,
+    /// which [`Painter::present`] acquires as late as possible. Recording the
+    /// next frame can start right away and overlap with the GPU drawing this one.
+    ///
+    /// Without multisampling the frame is drawn into an offscreen texture and
+    /// copied onto the surface when presented. A headless painter has nothing
+    /// to present, so this does the same as [`Painter::flush`].
+    pub fn end_frame(&mut self) {
+        let (viewport, scissor) = match self.begin_frame() {
+            Some(damage) => damage,
+            None => return,
+        };
 
-        self.reset();
+        let target = match &self.readback {
+            Some(readback) => FrameTarget::View(readback.view()),
+            None => {
+                if self.multisampled_framebuffer.is_none() && self.frame_target.is_none() {
+                    let (width, height) = self.surface.size;
+                    let format = self.surface.surface_config.format;
+                    self.frame_target =
+                        Some(
+                            self.compositor
+                                .create_target(&self.device, format, width, height),
+                        );
+                }
+                self.frame_pending = true;
+                FrameTarget::Deferred
+            }
+        };
+        self.submit_frame(target, &viewport, scissor);
+        self.profiler.end_frame();
     }
 
-    /// Flush the current state to the screen.
-    pub fn flush(&mut self) -> Result<(), wgpu::SurfaceError> {
-        let frame = self.surface.surface.get_current_texture()?;
+    /// Show the frame drawn by [`Painter::end_frame`] on the surface. Does
+    /// nothing if there is no such frame, or it was already presented.
+    pub fn present(&mut self) -> Result<(), wgpu::SurfaceError> {
+        if !std::mem::take(&mut self.frame_pending) {
+            return Ok(());
+        }
+        let surface = self.surface.surface.as_ref().unwrap();
+
+        let span = self.profiler.start();
+        let frame = match surface.get_current_texture() {
+            Ok(frame) => frame,
+            Err(error) => {
+                // The frame is still there to present once the surface is back.
+                self.frame_pending = true;
+                return Err(error);
+            }
+        };
         let view = frame
             .texture
             .create_view(&wgpu::TextureViewDescriptor::default());
+        self.profiler.record_closed("acquire", span);
+
+        let span = self.profiler.start();
         let mut encoder = self
             .device
             .create_command_encoder(&wgpu::CommandEncoderDescriptor {
-                label: Some("Render Encoder"),
+                label: Some("Present Encoder"),
             });
+        match &self.multisampled_framebuffer {
+            // Resolving is all there is left to do.
+            Some(multisampled) => {
+                encoder.begin_render_pass(&wgpu::RenderPassDescriptor {
+                    label: Some("Resolve Pass"),
+                    color_attachments: &[wgpu::RenderPassColorAttachment {
+                        view: multisampled,
+                        resolve_target: Some(&view),
+                        ops: wgpu::Operations {
+                            load: wgpu::LoadOp::Load,
+                            store: true,
+                        },
+                    }],
+                    depth_stencil_attachment: None,
+                });
+            }
+            None => {
+                let format = self.surface.surface_config.format;
+                let pipeline = self.compositor.present_pipeline(&self.device, format);
+                let mut render_pass = encoder.begin_render_pass(&wgpu::RenderPassDescriptor {
+                    label: Some("Present Pass"),
+                    color_attachments: &[wgpu::RenderPassColorAttachment {
+                        view: &view,
+                        resolve_target: None,
+                        ops: wgpu::Operations {
+                            load: wgpu::LoadOp::Clear(wgpu::Color {
+                                r: 0.0,
+                                g: 0.0,
+                                b: 0.0,
+                                a: 0.0,
+                            }),
+                            store: true,
+                        },
+                    }],
+                    depth_stencil_attachment: None,
+                });
+                render_pass.set_pipeline(pipeline);
+                render_pass.set_bind_group(
+                    0,
+                    self.frame_target.as_ref().unwrap().bind_group(),
+                    &[],
+                );
+                render_pass.draw(0..3, 0..1);
+            }
+        }
+        self.queue.submit(iter::once(encoder.finish()));
+        frame.present();
+        self.profiler.record_closed("present", span);
 
-        self.uniform_buffer.resize(
-            &self.device,
-            self.uniform_vec.len(),
-            &self.uniform_bind_group_layout,
-        );
-        self.queue.write_buffer(
-            &self.uniform_buffer.buffer,
-            0,
-            bytemuck::cast_slice(&self.uniform_vec),
-        );
+        Ok(())
+    }
+
+    /// Start flushing the current frame: collect finished tessellations and
+    /// find the part of the target to redraw, as a viewport to cull to and a
+    /// scissor rectangle. Returns `None` if the frame is skipped, because it
+    /// draws the same as the last one.
+    fn begin_frame(&mut self) -> Option<(Bounds, Option<[u32; 4]>)> {
+        let wait = match self.tessellation_mode {
+            TessellationMode::Parallel { pending, .. } => pending == PendingGeometry::Wait,
+            TessellationMode::Immediate => true,
+        };
+        self.profiler.begin_flush();
+        self.profiler.poll_gpu(&self.device);
+        let span = self.profiler.start();
+        self.collect_tessellations(wait);
+        self.profiler.record("collect tessellations", span);
+
+        let size = self.surface.size;
+        let viewport = Bounds::of_size(size);
+        if !self.damage_tracking {
+            return Some((viewport, None));
+        }
 
-        let mut used = HashSet::new();
+        let span = self.profiler.start();
+        let drawn = self.drawn_commands(&viewport);
+        let previous = match self.previous_frame.replace(drawn) {
+            Some(previous) => previous,
+            None => return Some((viewport, None)),
+        };
+        let current = self.previous_frame.as_ref().unwrap();
+        let damage = damage(&previous, current);
+        self.profiler.record("damage", span);
+        match damage {
+            // Only the multisampled framebuffer keeps the last frame;
+            // without it the whole target is redrawn.
+            Some(_) if self.multisampled_framebuffer.is_none() => Some((viewport, None)),
+            Some(damage) => {
+                // Leave room for antialiasing, and snap to whole pixels.
+                let x = (damage.min[0] - 1.).floor().max(0.);
+                let y = (damage.min[1] - 1.).floor().max(0.);
+                let right = (damage.max[0] + 1.).ceil().min(size.0 as f32);
+                let bottom = (damage.max[1] + 1.).ceil().min(size.1 as f32);
+                let viewport = Bounds {
+                    min: [x, y],
+                    max: [right, bottom],
+                };
+                let scissor = [x as u32, y as u32, (right - x) as u32, (bottom - y) as u32];
+                Some((viewport, Some(scissor)))
+            }
+            None => {
+                // The surface already shows this frame. Its geometry
+                // still counts as used, so idle frames do not evict it.
+                for command in self.stack.iter() {
+                    if let Command::RawGeometry { path, .. } = command {
+                        self.geometry_buffers.touch(path);
+                    }
+                }
+                self.reset_frame();
+                self.profiler.end_frame();
+                None
+            }
+        }
+    }
 
-        {
-            let mut render_pass = encoder.begin_render_pass(&wgpu::RenderPassDescriptor {
-                label: Some("Render Pass"),
-                color_attachments: &[wgpu::RenderPassColorAttachment {
-                    view: &self.multisampled_framebuffer,
-                    resolve_target: Some(&view),
-                    ops: wgpu::Operations {
-                        load: wgpu::LoadOp::Clear(wgpu::Color {
-                            r: 0.0,
-                            g: 0.0,
-                            b: 0.0,
-                            a: 0.0,
-                        }),
-                        store: true,
-                    },
-                }],
-                depth_stencil_attachment: None,
+    /// Encode and submit the current frame into `target`, and reset the per
+    /// frame state.
+    fn submit_frame(&mut self, target: FrameTarget, viewport: &Bounds, scissor: Option<[u32; 4]>) {
+        let mut encoder = self
+            .device
+            .create_command_encoder(&wgpu::CommandEncoderDescriptor {
+                label: Some("Render Encoder"),
             });
 
-            render_pass.set_pipeline(&self.render_pipeline);
-            for (i, command) in self.stack.iter().enumerate() {
-                match command {
-                    Command::RawGeometry {
-                        path,
-                        transform: _,
-                        indices,
-                        uniform_offset,
-                        vertices,
-                    } => {
-                        render_pass.set_bind_group(
-                            0,
-                            &self.uniform_buffer.bind_group,
-                            &[*uniform_offset as u32 * 256 as u32],
-                        );
+        let commands = std::mem::take(&mut self.stack);
+        let span = self.profiler.start();
+        let batches = self.prepare_batches(&commands, self.surface.size, viewport, false);
+        self.create_pipelines_for(&batches, scissor.is_some());
+        self.profiler.record("prepare", span);
+        let span = self.profiler.start();
+        self.profiler.begin_gpu(&mut encoder);
+        if let Some(path_raster) = &self.path_raster {
+            path_raster.encode(&mut encoder);
+        }
+        let multisampled = self.multisampled_framebuffer.as_ref();
+        let (view, resolve_target) = match &target {
+            FrameTarget::View(view) => (multisampled.unwrap_or(view), multisampled.map(|_| view)),
+            FrameTarget::Deferred => match multisampled {
+                Some(multisampled) => (multisampled, None),
+                None => (self.frame_target.as_ref().unwrap().view(), None),
+            },
+        };
+        self.draw_batches(&mut encoder, &batches, view, resolve_target, scissor);
+        self.profiler.end_gpu(&mut encoder);
+        drop(batches);
+        self.stack = commands;
+
+        let read_back = self.read_back;
+        if let Some(readback) = self.readback.as_mut().filter(|_| read_back) {
+            readback.copy(&self.device, &mut encoder);
+        }
+        self.profiler.record("encode", span);
+        let span = self.profiler.start();
+        self.queue.submit(iter::once(encoder.finish()));
+        self.profiler.submitted();
+        if let Some(readback) = self.readback.as_mut().filter(|_| read_back) {
+            readback.map();
+        }
+        self.profiler.record("submit", span);
+        self.reset_frame();
+    }
 
-                        let buffers = self.geometry_buffers.in_use.get(&path).unwrap();
-                        used.insert(path);
-                        render_pass.set_vertex_buffer(
-                            0,
-                            buffers.vertex_buffer.slice(0..(*vertices) as u64),
-                        );
-                        render_pass.set_index_buffer(
-                            buffers.index_buffer.slice(..),
-                            wgpu::IndexFormat::Uint16,
-                        );
-                        render_pass.draw_indexed(0..*indices as u32, 0, 0..1);
+    /// Reset the per frame state once a frame has been submitted or skipped,
+    /// and move on to the next set of frame buffers.
+    fn reset_frame(&mut self) {
+        self.instance_vec.clear();
+        self.glyph_instance_vec.clear();
+        self.shape_instance_vec.clear();
+
+        self.geometry_buffers.end_frame(&self.device, &self.queue);
+        self.glyph_atlas
+            .end_frame(self.geometry_buffers.policy.max_atlas_bytes);
+        match &mut self.recording {
+            // The layer keeps its transforms, and ends into those of the next frame.
+            Some(recording) => {
+                recording.transform = cgmath::Matrix4::identity();
+                recording.old_transforms.clear();
+            }
+            None => {
+                self.old_transforms.clear();
+                self.reset();
+            }
+        }
+        self.stack.clear();
+
+        let frame = std::mem::take(&mut self.frame_stats);
+        self.stats.tessellated_vertices = frame.tessellated_vertices;
+        self.stats.tessellated_indices = frame.tessellated_indices;
+        self.stats.draw_calls = frame.draw_calls;
+        self.stats.instances = frame.instances;
+        self.frame_index = (self.frame_index + 1) % self.frame_buffers.len();
+    }
+
+    /// What every command of the current frame draws inside `viewport`.
+    fn drawn_commands(&self, viewport: &Bounds) -> Vec<DrawnCommand> {
+        use std::hash::{Hash, Hasher};
+
+        self.stack
+            .iter()
+            .filter_map(|command| {
+                let mut hasher = std::collections::hash_map::DefaultHasher::new();
+                std::mem::discriminant(command).hash(&mut hasher);
+                let bounds = match command {
+                    Command::RawGeometry { path, instance } => {
+                        // Geometry that is still being tessellated is not drawn.
+                        let cached = self.geometry_buffers.in_use.get(path)?;
+                        path.hash(&mut hasher);
+                        bytemuck::bytes_of(instance).hash(&mut hasher);
+                        cached.bounds.transformed(&instance.transform)
+                    }
+                    Command::AtlasGlyph { page, instance } => {
+                        page.hash(&mut hasher);
+                        bytemuck::bytes_of(instance).hash(&mut hasher);
+                        Bounds::UNIT.transformed(&instance.transform)
                     }
+                    Command::Texture { texture, instance } => {
+                        texture.id().hash(&mut hasher);
+                        bytemuck::bytes_of(instance).hash(&mut hasher);
+                        Bounds::UNIT.transformed(&instance.transform)
+                    }
+                    Command::Shape { instance } => {
+                        bytemuck::bytes_of(instance).hash(&mut hasher);
+                        Bounds::UNIT.transformed(&instance.transform)
+                    }
+                    Command::RasterFill { path, instance, .. } => {
+                        path.key.hash(&mut hasher);
+                        bytemuck::bytes_of(instance).hash(&mut hasher);
+                        path.bounds.transformed(&instance.transform)
+                    }
+                };
+                if !bounds.intersects(viewport) {
+                    return None;
                 }
-            }
+                Some(DrawnCommand {
+                    hash: hasher.finish(),
+                    bounds,
+                })
+            })
+            .collect()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn range_allocator_allocates_best_fit() {
+        let mut allocator = RangeAllocator::new(100);
+        assert_eq!(allocator.allocate(10), Some(0..10));
+        assert_eq!(allocator.allocate(20), Some(10..30));
+        assert_eq!(allocator.allocate(0), Some(0..0));
+        assert_eq!(allocator.allocate(71), None);
+        assert_eq!(allocator.free_size(), 70);
+
+        // The smallest free range that fits is used.
+        allocator.free(0..10);
+        assert_eq!(allocator.allocate(5), Some(0..5));
+        assert_eq!(allocator.allocate(70), Some(30..100));
+        assert_eq!(allocator.free_size(), 5);
+    }
+
+    #[test]
+    fn range_allocator_coalesces_freed_ranges() {
+        let mut allocator = RangeAllocator::new(40);
+        let ranges: Vec<_> = (0..4).map(|_| allocator.allocate(10).unwrap()).collect();
+
+        allocator.free(ranges[0].clone());
+        allocator.free(ranges[2].clone());
+        assert_eq!(allocator.free, vec![0..10, 20..30]);
+        assert_eq!(allocator.largest_free(), 10);
+
+        // Merges with the free ranges on both sides.
+        allocator.free(ranges[1].clone());
+        assert_eq!(allocator.free, vec![0..30]);
+        allocator.free(ranges[3].clone());
+        assert_eq!(allocator.free, vec![0..40]);
+        assert!(allocator.is_empty());
+
+        allocator.free(0..0);
+        assert_eq!(allocator.free, vec![0..40]);
+    }
+
+    #[test]
+    fn range_allocator_compacts() {
+        let mut allocator = RangeAllocator::new(100);
+        let ranges: Vec<_> = (0..10).map(|_| allocator.allocate(10).unwrap()).collect();
+        for range in ranges.iter().step_by(2) {
+            allocator.free(range.clone());
         }
+        assert_eq!(allocator.free_size(), 50);
+        assert_eq!(allocator.largest_free(), 10);
+        assert_eq!(allocator.allocate(20), None);
+
+        // Compaction packs the 50 used units at the start.
+        allocator.reset_packed(50);
+        assert_eq!(allocator.free, vec![50..100]);
+        assert_eq!(allocator.allocate(20), Some(50..70));
+
+        allocator.reset_packed(100);
+        assert!(allocator.free.is_empty());
+        assert_eq!(allocator.allocate(1), None);
+    }
 
-        self.queue.submit(iter::once(encoder.finish()));
+    fn drawn(hash: u64, x: f32) -> DrawnCommand {
+        DrawnCommand {
+            hash,
+            bounds: Bounds {
+                min: [x, 0.],
+                max: [x + 10., 10.],
+            },
+        }
+    }
 
-        self.uniform_vec.clear();
+    fn bounds(min_x: f32, max_x: f32) -> Bounds {
+        Bounds {
+            min: [min_x, 0.],
+            max: [max_x, 10.],
+        }
+    }
 
-        self.old_transforms.clear();
-        self.geometry_buffers.free_unused(&used);
-        self.reset();
-        self.stack.clear();
+    #[test]
+    fn damage_of_unchanged_frames_is_none() {
+        let frame = [drawn(1, 0.), drawn(2, 20.)];
+        assert_eq!(damage(&frame, &frame), None);
+        assert_eq!(damage(&[], &[]), None);
+    }
 
-        frame.present();
-        //console_output(&self.latest_profiler_results);
+    #[test]
+    fn damage_covers_insertions_and_removals() {
+        let previous = [drawn(1, 0.)];
+        let current = [drawn(1, 0.), drawn(2, 20.), drawn(3, 40.)];
+        assert_eq!(damage(&previous, &current), Some(bounds(20., 50.)));
+        assert_eq!(damage(&current, &previous), Some(bounds(20., 50.)));
+    }
 
-        Ok(())
+    #[test]
+    fn damage_covers_changes_at_both_places() {
+        // A command that moved damages where it was and where it is.
+        let previous = [drawn(1, 0.), drawn(2, 20.)];
+        let current = [drawn(1, 0.), drawn(3, 60.)];
+        assert_eq!(damage(&previous, &current), Some(bounds(20., 70.)));
+    }
+
+    #[test]
+    fn damage_covers_reorders() {
+        // Swapping the stacking order changes the pixels where they overlap.
+        let previous = [drawn(1, 0.), drawn(2, 5.), drawn(3, 40.)];
+        let current = [drawn(2, 5.), drawn(1, 0.), drawn(3, 40.)];
+        assert_eq!(damage(&previous, &current), Some(bounds(0., 15.)));
     }
 }
@@ -0,0 +1,26 @@
+// copies a frame rendered ahead onto the surface
+
+[[group(0), binding(0)]]
+var frame: texture_2d<f32>;
+[[group(0), binding(1)]]
+var frame_sampler: sampler;
+
+struct VertexOutput {
+    [[builtin(position)]] clip_position: vec4<f32>;
+    [[location(0)]] uv: vec2<f32>;
+};
+
+[[stage(vertex)]]
+fn main([[builtin(vertex_index)]] vertex_index: u32) -> VertexOutput {
+    // One triangle covering the whole target, with the texture upright
+    let corner = vec2<f32>(f32((vertex_index << 1u) & 2u), f32(vertex_index & 2u));
+    var out: VertexOutput;
+    out.uv = vec2<f32>(corner.x, 1.0 - corner.y);
+    out.clip_position = vec4<f32>(corner * 2.0 - 1.0, 0.0, 1.0);
+    return out;
+}
+
+[[stage(fragment)]]
+fn main(in: VertexOutput) -> [[location(0)]] vec4<f32> {
+    return textureSample(frame, frame_sampler, in.uv);
+}
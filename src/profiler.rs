@@ -0,0 +1,309 @@
+// Opt-in per frame profiling: CPU spans and GPU timestamps, exported as Chrome trace JSON
+
+use crate::readback::poll_now;
+use std::collections::VecDeque;
+use std::future::Future;
+use std::pin::Pin;
+use std::time::{Duration, Instant};
+
+/// Frames kept for querying and export.
+const FRAMES: usize = 300;
+
+/// Device features the profiler uses when the adapter has them, to time the
+/// render pass on the GPU.
+pub(crate) const FEATURES: wgpu::Features = wgpu::Features::TIMESTAMP_QUERY;
+
+type MapFuture = Pin<Box<dyn Future<Output = Result<(), wgpu::BufferAsyncError>> + Send>>;
+
+/// A stretch of CPU work within a frame.
+#[derive(Clone, Debug)]
+pub struct Span {
+    pub name: &'static str,
+    /// Since profiling was enabled.
+    pub start: Duration,
+    pub duration: Duration,
+}
+
+/// Where the time of a frame went, from the first draw call after the previous
+/// flush to the end of its own flush. A frame drawn by `Painter::end_frame`
+/// also gets the spans of presenting it.
+#[derive(Clone, Debug, Default)]
+pub struct FrameProfile {
+    pub frame: u64,
+    pub spans: Vec<Span>,
+    /// Total time the draw calls spent looking up cached geometry.
+    pub cache_lookup: Duration,
+    pub cache_lookups: u32,
+    /// GPU time of the render pass, if the adapter supports timestamp queries.
+    /// It is filled in a frame or two later, once the GPU is done.
+    pub gpu_render: Option<Duration>,
+}
+
+enum GpuState {
+    Idle,
+    /// The first timestamp of `frame` is encoded.
+    Writing(u64),
+    /// Both timestamps are encoded, and mapping starts once they are submitted.
+    Encoded(u64),
+    Mapping(u64, MapFuture),
+}
+
+/// Timestamps written around the render pass, for one frame at a time.
+struct GpuTimer {
+    query_set: wgpu::QuerySet,
+    /// Queries resolve straight into a mappable buffer.
+    staging_buffer: wgpu::Buffer,
+    /// Nanoseconds per timestamp tick.
+    period: f32,
+    state: GpuState,
+}
+
+impl GpuTimer {
+    const SIZE: wgpu::BufferAddress = 2 * std::mem::size_of::<u64>() as wgpu::BufferAddress;
+
+    fn new(device: &wgpu::Device, queue: &wgpu::Queue) -> Self {
+        let query_set = device.create_query_set(&wgpu::QuerySetDescriptor {
+            label: Some("Profiler Timestamps"),
+            ty: wgpu::QueryType::Timestamp,
+            count: 2,
+        });
+        let staging_buffer = device.create_buffer(&wgpu::BufferDescriptor {
+            label: Some("Profiler Staging Buffer"),
+            size: Self::SIZE,
+            usage: wgpu::BufferUsages::MAP_READ | wgpu::BufferUsages::COPY_DST,
+            mapped_at_creation: false,
+        });
+
+        Self {
+            query_set,
+            staging_buffer,
+            period: queue.get_timestamp_period(),
+            state: GpuState::Idle,
+        }
+    }
+}
+
+pub(crate) struct Profiler {
+    enabled: bool,
+    epoch: Instant,
+    frame: FrameProfile,
+    flush_start: Option<Instant>,
+    frames: VecDeque<FrameProfile>,
+    /// `None` if the device has no timestamp queries.
+    gpu: Option<GpuTimer>,
+}
+
+impl Profiler {
+    pub(crate) fn new() -> Self {
+        Self {
+            enabled: false,
+            epoch: Instant::now(),
+            frame: FrameProfile::default(),
+            flush_start: None,
+            frames: VecDeque::new(),
+            gpu: None,
+        }
+    }
+
+    pub(crate) fn enabled(&self) -> bool {
+        self.enabled
+    }
+
+    /// Start or stop profiling. Starting over drops the recorded frames.
+    pub(crate) fn set_enabled(
+        &mut self,
+        device: &wgpu::Device,
+        queue: &wgpu::Queue,
+        enabled: bool,
+    ) {
+        if enabled && !self.enabled {
+            self.epoch = Instant::now();
+            self.frames.clear();
+            self.frame = FrameProfile {
+                frame: self.frame.frame,
+                ..FrameProfile::default()
+            };
+            if self.gpu.is_none() && device.features().contains(FEATURES) {
+                self.gpu = Some(GpuTimer::new(device, queue));
+            }
+        }
+        self.enabled = enabled;
+    }
+
+    /// The start of a span, if profiling.
+    pub(crate) fn start(&self) -> Option<Instant> {
+        if self.enabled {
+            Some(Instant::now())
+        } else {
+            None
+        }
+    }
+
+    /// Record a span from `start` until now.
+    pub(crate) fn record(&mut self, name: &'static str, start: Option<Instant>) {
+        if let Some(start) = start {
+            self.frame.spans.push(Span {
+                name,
+                start: start - self.epoch,
+                duration: start.elapsed(),
+            });
+        }
+    }
+
+    /// Record a span from `start` until now into the last closed frame, for
+    /// work on a frame after its flush, like presenting it.
+    pub(crate) fn record_closed(&mut self, name: &'static str, start: Option<Instant>) {
+        if let (Some(start), Some(frame)) = (start, self.frames.back_mut()) {
+            frame.spans.push(Span {
+                name,
+                start: start - self.epoch,
+                duration: start.elapsed(),
+            });
+        }
+    }
+
+    /// Count a cache lookup from `start` until now.
+    pub(crate) fn record_lookup(&mut self, start: Option<Instant>) {
+        if let Some(start) = start {
+            self.frame.cache_lookup += start.elapsed();
+            self.frame.cache_lookups += 1;
+        }
+    }
+
+    pub(crate) fn begin_flush(&mut self) {
+        self.flush_start = self.start();
+    }
+
+    /// Write the timestamp before the render pass, unless the previous one
+    /// is still being read.
+    pub(crate) fn begin_gpu(&mut self, encoder: &mut wgpu::CommandEncoder) {
+        if let (true, Some(gpu)) = (self.enabled, &mut self.gpu) {
+            if let GpuState::Idle = gpu.state {
+                encoder.write_timestamp(&gpu.query_set, 0);
+                gpu.state = GpuState::Writing(self.frame.frame);
+            }
+        }
+    }
+
+    pub(crate) fn end_gpu(&mut self, encoder: &mut wgpu::CommandEncoder) {
+        if let Some(gpu) = &mut self.gpu {
+            if let GpuState::Writing(frame) = gpu.state {
+                encoder.write_timestamp(&gpu.query_set, 1);
+                encoder.resolve_query_set(&gpu.query_set, 0..2, &gpu.staging_buffer, 0);
+                gpu.state = GpuState::Encoded(frame);
+            }
+        }
+    }
+
+    /// Start reading the timestamps back, after submitting them.
+    pub(crate) fn submitted(&mut self) {
+        if let Some(gpu) = &mut self.gpu {
+            if let GpuState::Encoded(frame) = gpu.state {
+                let future = gpu.staging_buffer.slice(..).map_async(wgpu::MapMode::Read);
+                gpu.state = GpuState::Mapping(frame, Box::pin(future));
+            }
+        }
+    }
+
+    /// Attach finished GPU timings to their frame, without blocking.
+    pub(crate) fn poll_gpu(&mut self, device: &wgpu::Device) {
+        let gpu = match &mut self.gpu {
+            Some(gpu) => gpu,
+            None => return,
+        };
+        let (frame, future) = match &mut gpu.state {
+            GpuState::Mapping(frame, future) => (*frame, future),
+            _ => return,
+        };
+
+        device.poll(wgpu::Maintain::Poll);
+        let duration = match poll_now(future) {
+            Some(Ok(())) => {
+                let duration = {
+                    let data = gpu.staging_buffer.slice(..).get_mapped_range();
+                    let timestamps: &[u64] = bytemuck::cast_slice(&data);
+                    let ticks = timestamps[1].saturating_sub(timestamps[0]);
+                    Duration::from_nanos((ticks as f64 * gpu.period as f64) as u64)
+                };
+                gpu.staging_buffer.unmap();
+                Some(duration)
+            }
+            Some(Err(_)) => None,
+            None => return,
+        };
+        gpu.state = GpuState::Idle;
+
+        if let Some(profile) = self
+            .frames
+            .iter_mut()
+            .find(|profile| profile.frame == frame)
+        {
+            profile.gpu_render = duration;
+        }
+    }
+
+    /// Close the frame, at the end of a flush.
+    pub(crate) fn end_frame(&mut self) {
+        let start = self.flush_start.take();
+        self.record("flush", start);
+
+        let next = FrameProfile {
+            frame: self.frame.frame + 1,
+            ..FrameProfile::default()
+        };
+        let frame = std::mem::replace(&mut self.frame, next);
+        if self.enabled {
+            if self.frames.len() == FRAMES {
+                self.frames.pop_front();
+            }
+            self.frames.push_back(frame);
+        }
+    }
+
+    pub(crate) fn frames(&self) -> impl Iterator<Item = &FrameProfile> {
+        self.frames.iter()
+    }
+
+    /// Write the recorded frames in the Chrome trace event format, with CPU
+    /// spans on thread 1 and the render pass GPU time on thread 2, placed
+    /// right after the frame was submitted.
+    pub(crate) fn write_chrome_trace(
+        &self,
+        writer: &mut impl std::io::Write,
+    ) -> std::io::Result<()> {
+        let micros = |duration: Duration| duration.as_secs_f64() * 1e6;
+
+        writeln!(writer, "{{")?;
+        writeln!(writer, "\"traceEvents\": [")?;
+        let mut first = true;
+        let mut event = |writer: &mut dyn std::io::Write, tid: u32, start, duration, name: &str| {
+            let separator = if first { "" } else { ",\n" };
+            first = false;
+            write!(
+                writer,
+                "{}{{ \"pid\":1, \"tid\":{}, \"ts\":{}, \"dur\":{}, \"ph\":\"X\", \"name\":\"{}\" }}",
+                separator,
+                tid,
+                micros(start),
+                micros(duration),
+                name
+            )
+        };
+        for frame in self.frames.iter() {
+            for span in frame.spans.iter() {
+                event(writer, 1, span.start, span.duration, span.name)?;
+            }
+            let submitted = frame
+                .spans
+                .iter()
+                .find(|span| span.name == "submit")
+                .map(|span| span.start + span.duration);
+            if let (Some(start), Some(duration)) = (submitted, frame.gpu_render) {
+                event(writer, 2, start, duration, "render pass (GPU)")?;
+            }
+        }
+        writeln!(writer)?;
+        writeln!(writer, "]")?;
+        writeln!(writer, "}}")
+    }
+}
@@ -0,0 +1,574 @@
+// Compute path rasterization: fills flattened on the CPU, binned into tiles and
+// accumulated into coverage by a compute shader, then composited as a texture
+
+use crate::{composite, Bounds};
+use lyon::path::iterator::PathIterator;
+use lyon::path::PathEvent;
+use std::ops::Range;
+
+/// Width and height of a tile in pixels, matching the workgroup size of the shader.
+const TILE_SIZE: u32 = 16;
+
+/// Flattening tolerance in pixels.
+const TOLERANCE: f32 = 0.25;
+
+/// Runs composited by a frame or layer at most. Fills that would start a run
+/// past this are tessellated instead.
+pub(crate) const MAX_RUNS: usize = 32;
+
+/// Format of the targets, premultiplied and linear at more than 8 bits so that
+/// dark coverage gradients do not band.
+const TARGET_FORMAT: wgpu::TextureFormat = wgpu::TextureFormat::Rgba16Float;
+
+/// A line of a flattened path, in pixels.
+#[repr(C)]
+#[derive(Copy, Clone, Debug, bytemuck::Pod, bytemuck::Zeroable)]
+struct Segment {
+    from: [f32; 2],
+    to: [f32; 2],
+}
+
+#[repr(C)]
+#[derive(Copy, Clone, Debug, bytemuck::Pod, bytemuck::Zeroable)]
+struct PathInfo {
+    /// Linear and premultiplied.
+    color: [f32; 4],
+    /// Pixel bounds, as the minimum followed by the maximum.
+    bounds: [f32; 4],
+    /// Index of the segment range of the first tile row in the ranges buffer.
+    row_offset: u32,
+    /// The first tile row the path covers.
+    first_row: u32,
+    _padding: [u32; 2],
+}
+
+/// Per run constants of the shader.
+#[repr(C)]
+#[derive(Copy, Clone, Debug, bytemuck::Pod, bytemuck::Zeroable)]
+struct Config {
+    /// Size of the target in pixels.
+    width: u32,
+    height: u32,
+    tiles_x: u32,
+    /// Index of the path range of the first tile in the ranges buffer.
+    tile_offset: u32,
+    /// Pixel of the frame at the origin of the target, on a tile corner.
+    origin: [u32; 2],
+    _padding: [u32; 2],
+}
+
+/// A storage buffer that grows to the next power of two.
+struct StorageBuffer {
+    buffer: wgpu::Buffer,
+    size: wgpu::BufferAddress,
+}
+
+impl StorageBuffer {
+    fn new(device: &wgpu::Device, label: &str, size: wgpu::BufferAddress) -> Self {
+        // Bindings cannot be empty.
+        let size = size.max(16).next_power_of_two();
+        let buffer = device.create_buffer(&wgpu::BufferDescriptor {
+            label: Some(label),
+            size,
+            usage: wgpu::BufferUsages::STORAGE | wgpu::BufferUsages::COPY_DST,
+            mapped_at_creation: false,
+        });
+        Self { buffer, size }
+    }
+
+    fn write<T: bytemuck::Pod>(
+        &mut self,
+        device: &wgpu::Device,
+        queue: &wgpu::Queue,
+        label: &str,
+        data: &[T],
+    ) {
+        let bytes: &[u8] = bytemuck::cast_slice(data);
+        if bytes.len() as wgpu::BufferAddress > self.size {
+            *self = Self::new(device, label, bytes.len() as _);
+        }
+        if !bytes.is_empty() {
+            queue.write_buffer(&self.buffer, 0, bytes);
+        }
+    }
+}
+
+/// The storage buffers of a frame, used in turn like the instance buffers.
+struct FrameStorage {
+    segments: StorageBuffer,
+    paths: StorageBuffer,
+    ranges: StorageBuffer,
+    tile_paths: StorageBuffer,
+}
+
+/// A texture a run of fills is rasterized into, with the constants of its run.
+struct Target {
+    texture: composite::LayerTexture,
+    config: wgpu::Buffer,
+    size: (u32, u32),
+}
+
+/// Consecutive fills rasterized into the same target.
+struct Run {
+    /// Indices of the fills in the paths of the frame.
+    paths: Range<usize>,
+    /// Tiles covered by the fills, as the minimum and the exclusive maximum.
+    tiles: Option<[u32; 4]>,
+    /// Set by `end`.
+    origin: [u32; 2],
+    size: (u32, u32),
+    /// Index in the target set, set by `upload`.
+    target: usize,
+}
+
+/// Rasterizes runs of consecutive fills with a compute shader. Each run is
+/// drawn into a target covering its fills and composited in its place.
+pub(crate) struct PathRaster {
+    /// Created on first use, like the other optional pipelines.
+    pipeline: Option<wgpu::ComputePipeline>,
+    bind_group_layout: wgpu::BindGroupLayout,
+    storage: Vec<FrameStorage>,
+    /// Targets of the frame and of cached layers, kept apart so that layers of
+    /// another size do not replace the ones the frame reuses. Targets that the
+    /// last upload of their set did not use are freed.
+    targets: [Vec<Target>; 2],
+    /// The target set of the runs being collected.
+    layer: bool,
+    size: (u32, u32),
+
+    segments: Vec<Segment>,
+    paths: Vec<PathInfo>,
+    /// Tiles covered by every fill, as the minimum and the exclusive maximum.
+    path_tiles: Vec<[u32; 4]>,
+    /// Segment ranges of every tile row of every path.
+    row_ranges: Vec<[u32; 2]>,
+    runs: Vec<Run>,
+    /// Flattened segments of the path being added.
+    scratch: Vec<Segment>,
+    /// Fills per tile of a run while binning.
+    tile_counts: Vec<u32>,
+    bind_groups: Vec<wgpu::BindGroup>,
+}
+
+impl PathRaster {
+    pub(crate) fn new(device: &wgpu::Device, frames: usize) -> Self {
+        let storage = |binding| wgpu::BindGroupLayoutEntry {
+            binding,
+            visibility: wgpu::ShaderStages::COMPUTE,
+            ty: wgpu::BindingType::Buffer {
+                ty: wgpu::BufferBindingType::Storage { read_only: true },
+                has_dynamic_offset: false,
+                min_binding_size: None,
+            },
+            count: None,
+        };
+        let bind_group_layout = device.create_bind_group_layout(&wgpu::BindGroupLayoutDescriptor {
+            entries: &[
+                wgpu::BindGroupLayoutEntry {
+                    binding: 0,
+                    visibility: wgpu::ShaderStages::COMPUTE,
+                    ty: wgpu::BindingType::Buffer {
+                        ty: wgpu::BufferBindingType::Uniform,
+                        has_dynamic_offset: false,
+                        min_binding_size: wgpu::BufferSize::new(std::mem::size_of::<Config>() as _),
+                    },
+                    count: None,
+                },
+                storage(1),
+                storage(2),
+                storage(3),
+                storage(4),
+                wgpu::BindGroupLayoutEntry {
+                    binding: 5,
+                    visibility: wgpu::ShaderStages::COMPUTE,
+                    ty: wgpu::BindingType::StorageTexture {
+                        access: wgpu::StorageTextureAccess::WriteOnly,
+                        format: TARGET_FORMAT,
+                        view_dimension: wgpu::TextureViewDimension::D2,
+                    },
+                    count: None,
+                },
+            ],
+            label: Some("Path Raster Bind Group Layout"),
+        });
+
+        let storage = (0..frames)
+            .map(|_| FrameStorage {
+                segments: StorageBuffer::new(device, "Path Raster Segments", 0),
+                paths: StorageBuffer::new(device, "Path Raster Paths", 0),
+                ranges: StorageBuffer::new(device, "Path Raster Ranges", 0),
+                tile_paths: StorageBuffer::new(device, "Path Raster Tile Paths", 0),
+            })
+            .collect();
+
+        Self {
+            pipeline: None,
+            bind_group_layout,
+            storage,
+            targets: [Vec::new(), Vec::new()],
+            layer: false,
+            size: (0, 0),
+            segments: Vec::new(),
+            paths: Vec::new(),
+            path_tiles: Vec::new(),
+            row_ranges: Vec::new(),
+            runs: Vec::new(),
+            scratch: Vec::new(),
+            tile_counts: Vec::new(),
+            bind_groups: Vec::new(),
+        }
+    }
+
+    /// Create the pipeline if it does not exist yet.
+    pub(crate) fn create_pipeline(&mut self, device: &wgpu::Device) {
+        if self.pipeline.is_some() {
+            return;
+        }
+
+        let shader = device.create_shader_module(&wgpu::ShaderModuleDescriptor {
+            label: Some("Path Raster Shader"),
+            source: wgpu::ShaderSource::Wgsl(include_str!("raster.wgsl").into()),
+        });
+        let pipeline_layout = device.create_pipeline_layout(&wgpu::PipelineLayoutDescriptor {
+            label: Some("Path Raster Pipeline Layout"),
+            bind_group_layouts: &[&self.bind_group_layout],
+            push_constant_ranges: &[],
+        });
+        self.pipeline = Some(
+            device.create_compute_pipeline(&wgpu::ComputePipelineDescriptor {
+                label: Some("Path Raster Pipeline"),
+                layout: Some(&pipeline_layout),
+                module: &shader,
+                entry_point: "main",
+            }),
+        );
+    }
+
+    /// Start collecting the runs of a frame, or of a cached layer if `layer`,
+    /// of `size` pixels.
+    pub(crate) fn begin(&mut self, size: (u32, u32), layer: bool) {
+        self.size = size;
+        self.layer = layer;
+        self.segments.clear();
+        self.paths.clear();
+        self.path_tiles.clear();
+        self.row_ranges.clear();
+        self.runs.clear();
+    }
+
+    /// The number of runs started since `begin`.
+    pub(crate) fn runs(&self) -> usize {
+        self.runs.len()
+    }
+
+    /// Start a new run, returning its index.
+    pub(crate) fn begin_run(&mut self) -> usize {
+        self.runs.push(Run {
+            paths: self.paths.len()..self.paths.len(),
+            tiles: None,
+            origin: [0; 2],
+            size: (TILE_SIZE, TILE_SIZE),
+            target: 0,
+        });
+        self.runs.len() - 1
+    }
+
+    /// Add a fill of `path` to the last run, with even-odd winding like
+    /// tessellated fills. `bounds` are the pixel bounds of the fill.
+    pub(crate) fn fill(
+        &mut self,
+        path: &lyon::path::Path,
+        transform: &[[f32; 2]; 3],
+        color: [u16; 4],
+        bounds: &Bounds,
+    ) {
+        let [width, height] = [self.size.0 as f32, self.size.1 as f32];
+        let min = [bounds.min[0].max(0.), bounds.min[1].max(0.)];
+        let max = [bounds.max[0].min(width), bounds.max[1].min(height)];
+        if min[0] >= max[0] || min[1] >= max[1] {
+            return;
+        }
+
+        let [x, y, w] = *transform;
+        let apply = |point: lyon::math::Point| {
+            [
+                x[0] * point.x + y[0] * point.y + w[0],
+                x[1] * point.x + y[1] * point.y + w[1],
+            ]
+        };
+        let scale = (x[0] * y[1] - x[1] * y[0]).abs().sqrt().max(1e-6);
+        self.scratch.clear();
+        for event in path.iter().flattened(TOLERANCE / scale) {
+            let (from, to) = match event {
+                PathEvent::Line { from, to } => (from, to),
+                // Fills are always closed.
+                PathEvent::End { last, first, .. } => (last, first),
+                _ => continue,
+            };
+            let segment = Segment {
+                from: apply(from),
+                to: apply(to),
+            };
+            // Horizontal lines never cross a scanline.
+            if segment.from[1] != segment.to[1] {
+                self.scratch.push(segment);
+            }
+        }
+
+        // Bin the segments into the tile rows they cross.
+        let tiles = [
+            min[0] as u32 / TILE_SIZE,
+            min[1] as u32 / TILE_SIZE,
+            (max[0].ceil() as u32 + TILE_SIZE - 1) / TILE_SIZE,
+            (max[1].ceil() as u32 + TILE_SIZE - 1) / TILE_SIZE,
+        ];
+        let row_offset = self.row_ranges.len() as u32;
+        for row in tiles[1]..tiles[3] {
+            let top = (row * TILE_SIZE) as f32;
+            let bottom = top + TILE_SIZE as f32;
+            let start = self.segments.len() as u32;
+            self.segments.extend(self.scratch.iter().filter(|segment| {
+                segment.from[1].min(segment.to[1]) < bottom
+                    && segment.from[1].max(segment.to[1]) > top
+            }));
+            self.row_ranges.push([start, self.segments.len() as u32]);
+        }
+
+        let alpha = color[3] as f32 / 65535.;
+        let channel = |value: u16| value as f32 / 65535. * alpha;
+        self.paths.push(PathInfo {
+            color: [
+                channel(color[0]),
+                channel(color[1]),
+                channel(color[2]),
+                alpha,
+            ],
+            bounds: [min[0], min[1], max[0], max[1]],
+            row_offset,
+            first_row: tiles[1],
+            _padding: [0; 2],
+        });
+        self.path_tiles.push(tiles);
+
+        let run = self.runs.last_mut().expect("fill outside of a run");
+        run.paths.end = self.paths.len();
+        run.tiles = Some(match run.tiles {
+            Some(union) => [
+                union[0].min(tiles[0]),
+                union[1].min(tiles[1]),
+                union[2].max(tiles[2]),
+                union[3].max(tiles[3]),
+            ],
+            None => tiles,
+        });
+    }
+
+    /// Finish the runs, placing their targets. Targets are rounded up to
+    /// powers of two, within the frame, so that later frames can reuse them.
+    pub(crate) fn end(&mut self) {
+        let frame_tiles = [
+            (self.size.0 + TILE_SIZE - 1) / TILE_SIZE,
+            (self.size.1 + TILE_SIZE - 1) / TILE_SIZE,
+        ];
+        for run in self.runs.iter_mut() {
+            let tiles = match run.tiles {
+                Some(tiles) => tiles,
+                None => continue,
+            };
+            let extent = |axis: usize| {
+                let tiles = tiles[axis + 2] - tiles[axis];
+                tiles.next_power_of_two().min(frame_tiles[axis]).max(tiles)
+            };
+            run.origin = [tiles[0] * TILE_SIZE, tiles[1] * TILE_SIZE];
+            run.size = (extent(0) * TILE_SIZE, extent(1) * TILE_SIZE);
+        }
+    }
+
+    /// Where the target of run `run` goes in the frame, as its origin and size
+    /// in pixels. Only valid after `end`.
+    pub(crate) fn placement(&self, run: usize) -> ([f32; 2], [f32; 2]) {
+        let run = &self.runs[run];
+        (
+            [run.origin[0] as f32, run.origin[1] as f32],
+            [run.size.0 as f32, run.size.1 as f32],
+        )
+    }
+
+    /// Upload the runs collected since `begin` into the storage buffers of
+    /// `frame`, assigning them targets. Returns the uploaded bytes.
+    pub(crate) fn upload(
+        &mut self,
+        device: &wgpu::Device,
+        queue: &wgpu::Queue,
+        compositor: &composite::Compositor,
+        frame: usize,
+    ) -> usize {
+        self.bind_groups.clear();
+        if self.runs.is_empty() {
+            return 0;
+        }
+
+        // Bin the fills of every run into the tiles of its target, counting
+        // them first so that every tile lists its fills in one range.
+        let mut ranges = std::mem::take(&mut self.row_ranges);
+        let mut tile_paths: Vec<u32> = Vec::new();
+        let mut tile_offsets = Vec::with_capacity(self.runs.len());
+        for run in self.runs.iter() {
+            let tiles_x = run.size.0 / TILE_SIZE;
+            let tile_count = (tiles_x * run.size.1 / TILE_SIZE) as usize;
+            let origin = [run.origin[0] / TILE_SIZE, run.origin[1] / TILE_SIZE];
+            let path_tiles = &self.path_tiles[run.paths.clone()];
+            let each_tile = |tiles: &[u32; 4], f: &mut dyn FnMut(usize)| {
+                for row in tiles[1]..tiles[3] {
+                    for column in tiles[0]..tiles[2] {
+                        f(((row - origin[1]) * tiles_x + column - origin[0]) as usize);
+                    }
+                }
+            };
+
+            self.tile_counts.clear();
+            self.tile_counts.resize(tile_count, 0);
+            let counts = &mut self.tile_counts;
+            for tiles in path_tiles.iter() {
+                each_tile(tiles, &mut |tile| counts[tile] += 1);
+            }
+            tile_offsets.push(ranges.len() as u32);
+            // Turn the counts into the next free slot of every tile.
+            let mut start = tile_paths.len() as u32;
+            for count in counts.iter_mut() {
+                ranges.push([start, start + *count]);
+                let end = start + *count;
+                *count = start;
+                start = end;
+            }
+            tile_paths.resize(start as usize, 0);
+            for (path, tiles) in run.paths.clone().zip(path_tiles.iter()) {
+                each_tile(tiles, &mut |tile| {
+                    tile_paths[counts[tile] as usize] = path as u32;
+                    counts[tile] += 1;
+                });
+            }
+        }
+
+        let storage = &mut self.storage[frame];
+        storage
+            .segments
+            .write(device, queue, "Path Raster Segments", &self.segments);
+        storage
+            .paths
+            .write(device, queue, "Path Raster Paths", &self.paths);
+        storage
+            .ranges
+            .write(device, queue, "Path Raster Ranges", &ranges);
+        storage
+            .tile_paths
+            .write(device, queue, "Path Raster Tile Paths", &tile_paths);
+        let bytes = std::mem::size_of_val(&self.segments[..])
+            + std::mem::size_of_val(&self.paths[..])
+            + std::mem::size_of_val(&ranges[..])
+            + std::mem::size_of_val(&tile_paths[..]);
+
+        // Reuse targets of the same size, and free the ones left over.
+        let mut unused = std::mem::take(&mut self.targets[self.layer as usize]);
+        let mut targets = Vec::with_capacity(self.runs.len());
+        for run in self.runs.iter_mut() {
+            let target = match unused.iter().position(|target| target.size == run.size) {
+                Some(index) => unused.swap_remove(index),
+                None => Target {
+                    texture: compositor.create_storage_target(
+                        device,
+                        TARGET_FORMAT,
+                        run.size.0,
+                        run.size.1,
+                    ),
+                    config: device.create_buffer(&wgpu::BufferDescriptor {
+                        label: Some("Path Raster Config"),
+                        size: std::mem::size_of::<Config>() as _,
+                        usage: wgpu::BufferUsages::UNIFORM | wgpu::BufferUsages::COPY_DST,
+                        mapped_at_creation: false,
+                    }),
+                    size: run.size,
+                },
+            };
+            run.target = targets.len();
+            targets.push(target);
+        }
+        self.targets[self.layer as usize] = targets;
+
+        let storage = &self.storage[frame];
+        for (run, tile_offset) in self.runs.iter().zip(tile_offsets) {
+            let target = &self.targets[self.layer as usize][run.target];
+            let config = Config {
+                width: run.size.0,
+                height: run.size.1,
+                tiles_x: run.size.0 / TILE_SIZE,
+                tile_offset,
+                origin: run.origin,
+                _padding: [0; 2],
+            };
+            queue.write_buffer(&target.config, 0, bytemuck::bytes_of(&config));
+            self.bind_groups
+                .push(device.create_bind_group(&wgpu::BindGroupDescriptor {
+                    layout: &self.bind_group_layout,
+                    entries: &[
+                        wgpu::BindGroupEntry {
+                            binding: 0,
+                            resource: target.config.as_entire_binding(),
+                        },
+                        wgpu::BindGroupEntry {
+                            binding: 1,
+                            resource: storage.segments.buffer.as_entire_binding(),
+                        },
+                        wgpu::BindGroupEntry {
+                            binding: 2,
+                            resource: storage.paths.buffer.as_entire_binding(),
+                        },
+                        wgpu::BindGroupEntry {
+                            binding: 3,
+                            resource: storage.ranges.buffer.as_entire_binding(),
+                        },
+                        wgpu::BindGroupEntry {
+                            binding: 4,
+                            resource: storage.tile_paths.buffer.as_entire_binding(),
+                        },
+                        wgpu::BindGroupEntry {
+                            binding: 5,
+                            resource: wgpu::BindingResource::TextureView(target.texture.view()),
+                        },
+                    ],
+                    label: Some("Path Raster Bind Group"),
+                }));
+        }
+
+        // Keep the allocation for the next frame.
+        ranges.clear();
+        self.row_ranges = ranges;
+        bytes
+    }
+
+    /// Rasterize every uploaded run into its target.
+    pub(crate) fn encode(&self, encoder: &mut wgpu::CommandEncoder) {
+        if self.bind_groups.is_empty() {
+            return;
+        }
+
+        let mut pass = encoder.begin_compute_pass(&wgpu::ComputePassDescriptor {
+            label: Some("Path Raster Pass"),
+        });
+        pass.set_pipeline(
+            self.pipeline
+                .as_ref()
+                .expect("path raster pipeline used before it was created"),
+        );
+        // The whole target is written, so no run sees what an older one left.
+        for (run, bind_group) in self.runs.iter().zip(self.bind_groups.iter()) {
+            pass.set_bind_group(0, bind_group, &[]);
+            pass.dispatch(run.size.0 / TILE_SIZE, run.size.1 / TILE_SIZE, 1);
+        }
+    }
+
+    /// The texture of run `run`, to composite once it is rasterized.
+    pub(crate) fn target(&self, run: usize) -> &composite::LayerTexture {
+        &self.targets[self.layer as usize][self.runs[run].target].texture
+    }
+}
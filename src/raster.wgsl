@@ -0,0 +1,113 @@
+// path rasterization shader
+
+[[block]]
+struct Config {
+    // Size of the target in pixels
+    width: u32;
+    height: u32;
+    tiles_x: u32;
+    // Index of the path range of the first tile in `ranges`
+    tile_offset: u32;
+    // Pixel of the frame at the origin of the target, on a tile corner
+    origin: vec2<u32>;
+    padding: vec2<u32>;
+};
+[[group(0), binding(0)]]
+var<uniform> config: Config;
+
+// A line of a flattened path, in pixels
+struct Segment {
+    p0: vec2<f32>;
+    p1: vec2<f32>;
+};
+[[block]]
+struct Segments {
+    items: array<Segment>;
+};
+[[group(0), binding(1)]]
+var<storage, read> segments: Segments;
+
+struct PathInfo {
+    // Linear and premultiplied
+    color: vec4<f32>;
+    // Pixel bounds, as the minimum followed by the maximum
+    bounds: vec4<f32>;
+    // Index of the segment range of the first tile row in `ranges`
+    row_offset: u32;
+    first_row: u32;
+    padding0: u32;
+    padding1: u32;
+};
+[[block]]
+struct Paths {
+    items: array<PathInfo>;
+};
+[[group(0), binding(2)]]
+var<storage, read> paths: Paths;
+
+// Segment ranges of every tile row of every path, followed by the path ranges
+// of every tile of every run
+[[block]]
+struct Ranges {
+    items: array<vec2<u32>>;
+};
+[[group(0), binding(3)]]
+var<storage, read> ranges: Ranges;
+
+[[block]]
+struct TilePaths {
+    items: array<u32>;
+};
+[[group(0), binding(4)]]
+var<storage, read> tile_paths: TilePaths;
+
+[[group(0), binding(5)]]
+var raster_target: texture_storage_2d<rgba16float, write>;
+
+// Area of the pixel at `pixel` covered by `path`, with the even-odd rule,
+// sampled along four scanlines
+fn path_coverage(path: PathInfo, pixel: vec2<f32>, row: u32) -> f32 {
+    if (pixel.x + 1.0 <= path.bounds.x || pixel.x >= path.bounds.z
+        || pixel.y + 1.0 <= path.bounds.y || pixel.y >= path.bounds.w) {
+        return 0.0;
+    }
+
+    let ys = vec4<f32>(pixel.y) + vec4<f32>(0.125, 0.375, 0.625, 0.875);
+    let range = ranges.items[path.row_offset + row - path.first_row];
+    // Winding at every scanline, averaged over the width of the pixel
+    var winding = vec4<f32>(0.0);
+    for (var i: u32 = range.x; i < range.y; i = i + 1u) {
+        let segment = segments.items[i];
+        let top = min(segment.p0.y, segment.p1.y);
+        let bottom = max(segment.p0.y, segment.p1.y);
+        let crosses = step(vec4<f32>(top), ys) * (vec4<f32>(1.0) - step(vec4<f32>(bottom), ys));
+        let dy = segment.p1.y - segment.p0.y;
+        let x = vec4<f32>(segment.p0.x)
+            + (ys - vec4<f32>(segment.p0.y)) * ((segment.p1.x - segment.p0.x) / dy);
+        // The part of the pixel right of the crossing
+        let right = clamp(vec4<f32>(pixel.x + 1.0) - x, vec4<f32>(0.0), vec4<f32>(1.0));
+        winding = winding + crosses * right * sign(dy);
+    }
+
+    let folded = abs(winding - 2.0 * floor(0.5 * winding + vec4<f32>(0.5)));
+    return min(dot(folded, vec4<f32>(0.25)), 1.0);
+}
+
+[[stage(compute), workgroup_size(16, 16)]]
+fn main([[builtin(global_invocation_id)]] id: vec3<u32>, [[builtin(workgroup_id)]] tile: vec3<u32>) {
+    if (id.x >= config.width || id.y >= config.height) {
+        return;
+    }
+
+    let frame_pixel = config.origin + id.xy;
+    let pixel = vec2<f32>(f32(frame_pixel.x), f32(frame_pixel.y));
+    let tile_range = ranges.items[config.tile_offset + tile.y * config.tiles_x + tile.x];
+    // Paths are over each other in drawing order
+    var color = vec4<f32>(0.0);
+    for (var i: u32 = tile_range.x; i < tile_range.y; i = i + 1u) {
+        let path = paths.items[tile_paths.items[i]];
+        let coverage = path_coverage(path, pixel, frame_pixel.y / 16u);
+        color = path.color * coverage + color * (1.0 - path.color.a * coverage);
+    }
+    textureStore(raster_target, vec2<i32>(i32(id.x), i32(id.y)), color);
+}
@@ -0,0 +1,209 @@
+// Offscreen target of a headless painter, read back through double buffered staging buffers
+
+use std::future::Future;
+use std::pin::Pin;
+use std::task::{Context, Poll, RawWaker, RawWakerVTable, Waker};
+
+type MapFuture = Pin<Box<dyn Future<Output = Result<(), wgpu::BufferAsyncError>> + Send>>;
+
+enum Staging {
+    Idle,
+    /// The copy of a frame is encoded, and mapping starts once it is submitted.
+    Copied,
+    Mapping(MapFuture),
+    Mapped,
+}
+
+struct StagingBuffer {
+    buffer: wgpu::Buffer,
+    state: Staging,
+    /// The frame the buffer holds, unless it is idle.
+    frame: u64,
+}
+
+/// Render target of a headless painter. A flushed frame is copied into one of
+/// two staging buffers, so that the next frame can render while the previous
+/// one is read back.
+pub(crate) struct Readback {
+    texture: wgpu::Texture,
+    size: (u32, u32),
+    /// Bytes per row in the staging buffers, padded to the copy alignment.
+    padded_bytes_per_row: u32,
+    staging: [StagingBuffer; 2],
+    frame: u64,
+}
+
+impl Readback {
+    pub(crate) fn new(
+        device: &wgpu::Device,
+        format: wgpu::TextureFormat,
+        size: (u32, u32),
+    ) -> Self {
+        let texture = device.create_texture(&wgpu::TextureDescriptor {
+            label: Some("Headless Target"),
+            size: wgpu::Extent3d {
+                width: size.0,
+                height: size.1,
+                depth_or_array_layers: 1,
+            },
+            mip_level_count: 1,
+            sample_count: 1,
+            dimension: wgpu::TextureDimension::D2,
+            format,
+            usage: wgpu::TextureUsages::RENDER_ATTACHMENT | wgpu::TextureUsages::COPY_SRC,
+        });
+
+        let align = wgpu::COPY_BYTES_PER_ROW_ALIGNMENT;
+        let padded_bytes_per_row = (size.0 * 4 + align - 1) / align * align;
+        let staging = || StagingBuffer {
+            buffer: device.create_buffer(&wgpu::BufferDescriptor {
+                label: Some("Readback Buffer"),
+                size: (padded_bytes_per_row * size.1) as wgpu::BufferAddress,
+                usage: wgpu::BufferUsages::MAP_READ | wgpu::BufferUsages::COPY_DST,
+                mapped_at_creation: false,
+            }),
+            state: Staging::Idle,
+            frame: 0,
+        };
+
+        Self {
+            texture,
+            size,
+            padded_bytes_per_row,
+            staging: [staging(), staging()],
+            frame: 0,
+        }
+    }
+
+    pub(crate) fn view(&self) -> wgpu::TextureView {
+        self.texture
+            .create_view(&wgpu::TextureViewDescriptor::default())
+    }
+
+    /// Bytes of a tightly packed frame.
+    pub(crate) fn frame_size(&self) -> usize {
+        (self.size.0 * self.size.1 * 4) as usize
+    }
+
+    /// Encode the copy of the rendered frame into a staging buffer. If both
+    /// hold unread frames, the oldest one is dropped.
+    pub(crate) fn copy(&mut self, device: &wgpu::Device, encoder: &mut wgpu::CommandEncoder) {
+        let slot = match self
+            .staging
+            .iter()
+            .position(|staging| matches!(staging.state, Staging::Idle))
+        {
+            Some(slot) => slot,
+            None => self.oldest().unwrap(),
+        };
+        let staging = &mut self.staging[slot];
+        match std::mem::replace(&mut staging.state, Staging::Idle) {
+            Staging::Mapping(mut future) => {
+                device.poll(wgpu::Maintain::Wait);
+                if let Some(Ok(())) = poll_now(&mut future) {
+                    staging.buffer.unmap();
+                }
+            }
+            Staging::Mapped => staging.buffer.unmap(),
+            Staging::Idle | Staging::Copied => {}
+        }
+
+        encoder.copy_texture_to_buffer(
+            self.texture.as_image_copy(),
+            wgpu::ImageCopyBuffer {
+                buffer: &staging.buffer,
+                layout: wgpu::ImageDataLayout {
+                    offset: 0,
+                    bytes_per_row: std::num::NonZeroU32::new(self.padded_bytes_per_row),
+                    rows_per_image: None,
+                },
+            },
+            wgpu::Extent3d {
+                width: self.size.0,
+                height: self.size.1,
+                depth_or_array_layers: 1,
+            },
+        );
+        staging.state = Staging::Copied;
+        staging.frame = self.frame;
+        self.frame += 1;
+    }
+
+    /// Start mapping the frame copied by [`Readback::copy`], after submitting it.
+    pub(crate) fn map(&mut self) {
+        for staging in self.staging.iter_mut() {
+            if let Staging::Copied = staging.state {
+                let future = staging.buffer.slice(..).map_async(wgpu::MapMode::Read);
+                staging.state = Staging::Mapping(Box::pin(future));
+            }
+        }
+    }
+
+    /// Copy the oldest unread frame into `pixels`, as tightly packed rows.
+    /// Without `wait`, only a frame whose readback already finished is copied.
+    pub(crate) fn read(&mut self, device: &wgpu::Device, pixels: &mut [u8], wait: bool) -> bool {
+        let slot = match self.oldest() {
+            Some(slot) => slot,
+            None => return false,
+        };
+        let staging = &mut self.staging[slot];
+
+        if let Staging::Mapping(future) = &mut staging.state {
+            device.poll(if wait {
+                wgpu::Maintain::Wait
+            } else {
+                wgpu::Maintain::Poll
+            });
+            match poll_now(future) {
+                Some(Ok(())) => staging.state = Staging::Mapped,
+                Some(Err(error)) => {
+                    log::warn!("failed to read back frame {}: {:?}", staging.frame, error);
+                    staging.state = Staging::Idle;
+                    return false;
+                }
+                None => return false,
+            }
+        }
+
+        let row = (self.size.0 * 4) as usize;
+        let padded_row = self.padded_bytes_per_row as usize;
+        {
+            let data = staging.buffer.slice(..).get_mapped_range();
+            for (target, source) in pixels
+                .chunks_exact_mut(row)
+                .zip(data.chunks_exact(padded_row))
+            {
+                target.copy_from_slice(&source[..row]);
+            }
+        }
+        staging.buffer.unmap();
+        staging.state = Staging::Idle;
+        true
+    }
+
+    /// The staging buffer holding the oldest frame that was not read yet.
+    fn oldest(&self) -> Option<usize> {
+        (0..self.staging.len())
+            .filter(|&slot| !matches!(self.staging[slot].state, Staging::Idle))
+            .min_by_key(|&slot| self.staging[slot].frame)
+    }
+}
+
+/// Poll `future` once, without a task to wake. Map futures only make progress
+/// through `Device::poll`, so nothing needs waking.
+pub(crate) fn poll_now<F: Future + Unpin>(future: &mut F) -> Option<F::Output> {
+    fn raw_waker() -> RawWaker {
+        fn clone(_: *const ()) -> RawWaker {
+            raw_waker()
+        }
+        fn noop(_: *const ()) {}
+        static VTABLE: RawWakerVTable = RawWakerVTable::new(clone, noop, noop, noop);
+        RawWaker::new(std::ptr::null(), &VTABLE)
+    }
+
+    let waker = unsafe { Waker::from_raw(raw_waker()) };
+    match Pin::new(future).poll(&mut Context::from_waker(&waker)) {
+        Poll::Ready(output) => Some(output),
+        Poll::Pending => None,
+    }
+}
@@ -9,7 +9,15 @@ var<uniform> uniforms: Uniforms;
 
 struct VertexInput {
     [[location(0)]] position: vec2<f32>;
-    [[location(1)]] color: vec4<f32>;
+};
+
+// 2D affine transform: the two basis columns followed by the translation
+struct InstanceInput {
+    [[location(2)]] transform_x: vec2<f32>;
+    [[location(3)]] transform_y: vec2<f32>;
+    [[location(4)]] translation: vec2<f32>;
+    // Linear, converted from sRGB when the instance was made
+    [[location(5)]] color: vec4<f32>;
 };
 
 struct VertexOutput {
@@ -17,23 +25,18 @@ struct VertexOutput {
     [[location(0)]] color: vec4<f32>;
 };
 
-fn linear_from_srgb(srgb: vec3<f32>) -> vec3<f32> {
-    let cutoff = srgb < vec3<f32>(10.31475);
-    let lower = srgb / vec3<f32>(3294.6);
-    let higher = pow((srgb + vec3<f32>(14.025)) / vec3<f32>(269.025), vec3<f32>(2.4));
-    return select(higher, lower, cutoff);
-}
-
 [[stage(vertex)]]
-fn main(model: VertexInput) -> VertexOutput {
+fn main(model: VertexInput, instance: InstanceInput) -> VertexOutput {
+    let position = instance.transform_x * model.position.x
+        + instance.transform_y * model.position.y
+        + instance.translation;
     var out: VertexOutput;
-    let color = model.color * 255.0;
-    out.color = vec4<f32>(linear_from_srgb(color.rgb), model.color.a);
-    out.clip_position = uniforms.view_proj * vec4<f32>(model.position, 0.0, 1.0);
+    out.color = instance.color;
+    out.clip_position = uniforms.view_proj * vec4<f32>(position, 0.0, 1.0);
     return out;
 }
 
 [[stage(fragment)]]
 fn main(in: VertexOutput) -> [[location(0)]] vec4<f32> {
     return vec4<f32>(in.color);
-}
\ No newline at end of file
+}
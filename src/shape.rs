@@ -0,0 +1,125 @@
+// Analytic shapes: circles and rounded rectangles drawn as single quads,
+// antialiased with their signed distance in the fragment shader
+
+use crate::{transform_scale, Color, Instance, PREMULTIPLIED_BLEND};
+
+/// Per-instance data of a shape quad: the placement and color of the geometry
+/// pipeline, the rectangle of shape coordinates the quad covers, and the shape.
+#[repr(C)]
+#[derive(Copy, Clone, Debug, bytemuck::Pod, bytemuck::Zeroable)]
+pub(crate) struct ShapeInstance {
+    pub(crate) transform: [[f32; 2]; 3],
+    color: [u16; 4],
+    /// Shape coordinates at the corners (0, 0) and (1, 1) of the quad, relative
+    /// to the center of the shape.
+    local: [f32; 4],
+    /// Half width, half height, corner radius and half line width, which is
+    /// zero for filled shapes.
+    shape: [f32; 4],
+}
+
+impl ShapeInstance {
+    /// A rounded rectangle centered on `(x, y)`, stroked if `line_width` is
+    /// positive and filled otherwise.
+    pub(crate) fn rounded_rectangle(
+        transform: &cgmath::Matrix4<f32>,
+        (x, y): (f32, f32),
+        (half_width, half_height): (f32, f32),
+        radius: f32,
+        line_width: f32,
+        color: Color,
+    ) -> Self {
+        let half_width = half_width.abs();
+        let half_height = half_height.abs();
+        let radius = radius.abs().min(half_width).min(half_height);
+        let half_line = line_width.max(0.) / 2.;
+        // Leave a pixel around the shape for the antialiased edge.
+        let margin = half_line + 1. / transform_scale(transform).max(1e-6);
+        let (quad_x, quad_y) = (half_width + margin, half_height + margin);
+
+        let placement = Instance::placed(
+            transform,
+            x - quad_x,
+            y - quad_y,
+            2. * quad_x,
+            2. * quad_y,
+            color,
+        );
+        Self {
+            transform: placement.transform,
+            color: placement.color,
+            local: [-quad_x, -quad_y, quad_x, quad_y],
+            shape: [half_width, half_height, radius, half_line],
+        }
+    }
+
+    const ATTRIBUTES: [wgpu::VertexAttribute; 6] = wgpu::vertex_attr_array![
+        2 => Float32x2,
+        3 => Float32x2,
+        4 => Float32x2,
+        5 => Unorm16x4,
+        6 => Float32x4,
+        7 => Float32x4,
+    ];
+
+    fn desc<'a>() -> wgpu::VertexBufferLayout<'a> {
+        wgpu::VertexBufferLayout {
+            array_stride: std::mem::size_of::<ShapeInstance>() as wgpu::BufferAddress,
+            step_mode: wgpu::VertexStepMode::Instance,
+            attributes: &Self::ATTRIBUTES,
+        }
+    }
+}
+
+pub(crate) fn create_pipeline(
+    device: &wgpu::Device,
+    uniform_bind_group_layout: &wgpu::BindGroupLayout,
+    format: wgpu::TextureFormat,
+    sample_count: u32,
+) -> wgpu::RenderPipeline {
+    let shader = device.create_shader_module(&wgpu::ShaderModuleDescriptor {
+        label: Some("Shape Shader"),
+        source: wgpu::ShaderSource::Wgsl(include_str!("shape.wgsl").into()),
+    });
+
+    let pipeline_layout = device.create_pipeline_layout(&wgpu::PipelineLayoutDescriptor {
+        label: Some("Shape Pipeline Layout"),
+        bind_group_layouts: &[uniform_bind_group_layout],
+        push_constant_ranges: &[],
+    });
+
+    device.create_render_pipeline(&wgpu::RenderPipelineDescriptor {
+        label: Some("Shape Pipeline"),
+        layout: Some(&pipeline_layout),
+        vertex: wgpu::VertexState {
+            module: &shader,
+            entry_point: "main",
+            buffers: &[ShapeInstance::desc()],
+        },
+        fragment: Some(wgpu::FragmentState {
+            module: &shader,
+            entry_point: "main",
+            targets: &[wgpu::ColorTargetState {
+                format,
+                blend: Some(PREMULTIPLIED_BLEND),
+                write_mask: wgpu::ColorWrites::ALL,
+            }],
+        }),
+        primitive: wgpu::PrimitiveState {
+            // Quads are generated from the vertex index.
+            topology: wgpu::PrimitiveTopology::TriangleStrip,
+            strip_index_format: None,
+            front_face: wgpu::FrontFace::Ccw,
+            cull_mode: None,
+            polygon_mode: wgpu::PolygonMode::Fill,
+            clamp_depth: false,
+            conservative: false,
+        },
+        depth_stencil: None,
+        multisample: wgpu::MultisampleState {
+            count: sample_count,
+            mask: !0,
+            alpha_to_coverage_enabled: false,
+        },
+    })
+}
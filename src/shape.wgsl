@@ -0,0 +1,56 @@
+// analytic shape shader
+
+[[block]]
+struct Uniforms {
+    view_proj: mat4x4<f32>;
+};
+[[group(0), binding(0)]]
+var<uniform> uniforms: Uniforms;
+
+// 2D affine transform of the unit quad, followed by the shape coordinates at
+// its corners and the shape: half size, corner radius and half line width
+struct InstanceInput {
+    [[location(2)]] transform_x: vec2<f32>;
+    [[location(3)]] transform_y: vec2<f32>;
+    [[location(4)]] translation: vec2<f32>;
+    // Linear, converted from sRGB when the instance was made
+    [[location(5)]] color: vec4<f32>;
+    [[location(6)]] local: vec4<f32>;
+    [[location(7)]] shape: vec4<f32>;
+};
+
+struct VertexOutput {
+    [[builtin(position)]] clip_position: vec4<f32>;
+    [[location(0)]] color: vec4<f32>;
+    [[location(1)]] local: vec2<f32>;
+    [[location(2)]] shape: vec4<f32>;
+};
+
+[[stage(vertex)]]
+fn main([[builtin(vertex_index)]] vertex_index: u32, instance: InstanceInput) -> VertexOutput {
+    // Triangle strip over the corners (0, 0), (1, 0), (0, 1), (1, 1)
+    let corner = vec2<f32>(f32(vertex_index & 1u), f32(vertex_index >> 1u));
+    let position = instance.transform_x * corner.x
+        + instance.transform_y * corner.y
+        + instance.translation;
+    var out: VertexOutput;
+    out.color = instance.color;
+    out.local = mix(instance.local.xy, instance.local.zw, corner);
+    out.shape = instance.shape;
+    out.clip_position = uniforms.view_proj * vec4<f32>(position, 0.0, 1.0);
+    return out;
+}
+
+[[stage(fragment)]]
+fn main(in: VertexOutput) -> [[location(0)]] vec4<f32> {
+    // Signed distance to a rounded rectangle, negative inside
+    let radius = in.shape.z;
+    let q = abs(in.local) - in.shape.xy + vec2<f32>(radius);
+    var distance: f32 = length(max(q, vec2<f32>(0.0))) + min(max(q.x, q.y), 0.0) - radius;
+    if (in.shape.w > 0.0) {
+        distance = abs(distance) - in.shape.w;
+    }
+    // Cover the pixel by how far its center is inside the edge, in pixels.
+    let coverage = clamp(0.5 - distance / max(fwidth(distance), 1e-6), 0.0, 1.0);
+    return vec4<f32>(in.color.rgb, in.color.a * coverage);
+}
@@ -0,0 +1,269 @@
+// Tessellation of paths, on the calling thread or on a pool of worker threads
+
+use crate::{UniqueGeometry, Vertex};
+use lyon::tessellation::*;
+use std::sync::{mpsc, Arc, Mutex};
+
+/// What to tessellate for a cache miss.
+#[derive(Clone)]
+pub(crate) enum Job {
+    Fill(Arc<lyon::path::Path>, FillOptions),
+    Stroke(Arc<lyon::path::Path>, StrokeOptions),
+    UnitRectangle,
+    /// The unit circle at the given tolerance.
+    UnitCircle(f32),
+}
+
+fn fill_vertex(vertex: FillVertex) -> Vertex {
+    Vertex {
+        position: vertex.position().to_array(),
+    }
+}
+
+fn stroke_vertex(vertex: StrokeVertex) -> Vertex {
+    Vertex {
+        position: vertex.position().to_array(),
+    }
+}
+
+/// Indices of tessellated geometry, 32 bit only when 16 bit indices cannot
+/// address every vertex.
+#[derive(Clone, Copy)]
+pub(crate) enum Indices<'a> {
+    U16(&'a [u16]),
+    U32(&'a [u32]),
+}
+
+impl<'a> Indices<'a> {
+    pub(crate) fn as_bytes(&self) -> &'a [u8] {
+        match *self {
+            Indices::U16(indices) => bytemuck::cast_slice(indices),
+            Indices::U32(indices) => bytemuck::cast_slice(indices),
+        }
+    }
+
+    pub(crate) fn len(&self) -> usize {
+        match *self {
+            Indices::U16(indices) => indices.len(),
+            Indices::U32(indices) => indices.len(),
+        }
+    }
+}
+
+/// Tessellated geometry borrowed from a [`Tessellator`] or a [`Geometry`].
+#[derive(Clone, Copy)]
+pub(crate) struct GeometryRef<'a> {
+    pub(crate) vertices: &'a [Vertex],
+    pub(crate) indices: Indices<'a>,
+}
+
+impl GeometryRef<'_> {
+    fn to_owned(&self) -> Geometry {
+        match self.indices {
+            Indices::U16(indices) => Geometry::U16(VertexBuffers {
+                vertices: self.vertices.to_vec(),
+                indices: indices.to_vec(),
+            }),
+            Indices::U32(indices) => Geometry::U32(VertexBuffers {
+                vertices: self.vertices.to_vec(),
+                indices: indices.to_vec(),
+            }),
+        }
+    }
+}
+
+/// Tessellated geometry owned by the caller, as sent back by the worker pool.
+pub(crate) enum Geometry {
+    U16(VertexBuffers<Vertex, u16>),
+    U32(VertexBuffers<Vertex, u32>),
+}
+
+impl Geometry {
+    pub(crate) fn as_ref(&self) -> GeometryRef<'_> {
+        match self {
+            Geometry::U16(geometry) => GeometryRef {
+                vertices: &geometry.vertices,
+                indices: Indices::U16(&geometry.indices),
+            },
+            Geometry::U32(geometry) => GeometryRef {
+                vertices: &geometry.vertices,
+                indices: Indices::U32(&geometry.indices),
+            },
+        }
+    }
+}
+
+/// Tessellators and output buffers that are reused across jobs, so that a
+/// cache miss does not allocate scratch space.
+pub(crate) struct Tessellator {
+    fill: FillTessellator,
+    stroke: StrokeTessellator,
+    geometry: VertexBuffers<Vertex, u16>,
+    wide_geometry: VertexBuffers<Vertex, u32>,
+}
+
+impl Tessellator {
+    pub(crate) fn new() -> Self {
+        Self {
+            fill: FillTessellator::new(),
+            stroke: StrokeTessellator::new(),
+            geometry: VertexBuffers::new(),
+            wide_geometry: VertexBuffers::new(),
+        }
+    }
+
+    /// Tessellate `job`, replacing the geometry of the previous one.
+    pub(crate) fn tessellate(&mut self, job: &Job) -> Result<GeometryRef<'_>, TessellationError> {
+        // Nearly everything fits 16 bit indices; only geometry with too many
+        // vertices for them is tessellated again with 32 bit indices. Lyon
+        // reports a full geometry builder as `TooManyVertices`.
+        match tessellate_into(&mut self.fill, &mut self.stroke, job, &mut self.geometry) {
+            Err(TessellationError::TooManyVertices) => {}
+            result => {
+                result?;
+                while self.geometry.indices.len() * 2 % 4 != 0 {
+                    self.geometry.indices.push(0);
+                }
+                return Ok(GeometryRef {
+                    vertices: &self.geometry.vertices,
+                    indices: Indices::U16(&self.geometry.indices),
+                });
+            }
+        }
+
+        tessellate_into(
+            &mut self.fill,
+            &mut self.stroke,
+            job,
+            &mut self.wide_geometry,
+        )?;
+        Ok(GeometryRef {
+            vertices: &self.wide_geometry.vertices,
+            indices: Indices::U32(&self.wide_geometry.indices),
+        })
+    }
+}
+
+fn tessellate_into<I>(
+    fill: &mut FillTessellator,
+    stroke: &mut StrokeTessellator,
+    job: &Job,
+    geometry: &mut VertexBuffers<Vertex, I>,
+) -> Result<(), TessellationError>
+where
+    I: std::ops::Add + From<VertexId> + geometry_builder::MaxIndex,
+{
+    geometry.vertices.clear();
+    geometry.indices.clear();
+
+    match job {
+        Job::Fill(path, options) => {
+            fill.tessellate_path(
+                path.as_ref(),
+                options,
+                &mut BuffersBuilder::new(geometry, fill_vertex),
+            )?;
+        }
+        Job::Stroke(path, options) => {
+            stroke.tessellate_path(
+                path.as_ref(),
+                options,
+                &mut BuffersBuilder::new(geometry, stroke_vertex),
+            )?;
+        }
+        Job::UnitRectangle => {
+            fill.tessellate_rectangle(
+                &lyon::math::rect(0., 0., 1., 1.),
+                &FillOptions::tolerance(0.1),
+                &mut BuffersBuilder::new(geometry, fill_vertex),
+            )?;
+        }
+        Job::UnitCircle(tolerance) => {
+            fill.tessellate_circle(
+                lyon::math::point(0., 0.),
+                1.,
+                &FillOptions::tolerance(*tolerance),
+                &mut BuffersBuilder::new(geometry, fill_vertex),
+            )?;
+        }
+    }
+
+    Ok(())
+}
+
+/// Worker threads tessellating cache misses in parallel.
+pub(crate) struct TessellationPool {
+    jobs: Option<mpsc::Sender<(UniqueGeometry, Job)>>,
+    results: mpsc::Receiver<(UniqueGeometry, Geometry)>,
+    workers: Vec<std::thread::JoinHandle<()>>,
+}
+
+impl TessellationPool {
+    pub(crate) fn new(threads: usize) -> Self {
+        let (jobs, job_receiver) = mpsc::channel::<(UniqueGeometry, Job)>();
+        let (result_sender, results) = mpsc::channel();
+        let job_receiver = Arc::new(Mutex::new(job_receiver));
+
+        let workers = (0..threads.max(1))
+            .map(|i| {
+                let jobs = job_receiver.clone();
+                let results = result_sender.clone();
+                std::thread::Builder::new()
+                    .name(format!("bufro tessellator {}", i))
+                    .spawn(move || {
+                        let mut tessellator = Tessellator::new();
+                        loop {
+                            let job = jobs.lock().unwrap().recv();
+                            let (uniq, job) = match job {
+                                Ok(job) => job,
+                                Err(_) => return,
+                            };
+                            // A failed tessellation still produces a result, so
+                            // that nobody waits for it forever.
+                            let geometry = match tessellator.tessellate(&job) {
+                                Ok(geometry) => geometry.to_owned(),
+                                Err(error) => {
+                                    log::warn!("failed to tessellate {:?}: {:?}", uniq, error);
+                                    Geometry::U16(VertexBuffers::new())
+                                }
+                            };
+                            if results.send((uniq, geometry)).is_err() {
+                                return;
+                            }
+                        }
+                    })
+                    .unwrap()
+            })
+            .collect();
+
+        Self {
+            jobs: Some(jobs),
+            results,
+            workers,
+        }
+    }
+
+    pub(crate) fn submit(&self, uniq: UniqueGeometry, job: Job) {
+        self.jobs.as_ref().unwrap().send((uniq, job)).unwrap();
+    }
+
+    /// Get a finished tessellation without blocking.
+    pub(crate) fn try_result(&self) -> Option<(UniqueGeometry, Geometry)> {
+        self.results.try_recv().ok()
+    }
+
+    /// Wait for the next finished tessellation.
+    pub(crate) fn result(&self) -> (UniqueGeometry, Geometry) {
+        self.results.recv().unwrap()
+    }
+}
+
+impl Drop for TessellationPool {
+    fn drop(&mut self) {
+        // Closing the job queue stops the workers once they are idle.
+        self.jobs = None;
+        for worker in self.workers.drain(..) {
+            let _ = worker.join();
+        }
+    }
+}